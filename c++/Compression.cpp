@@ -0,0 +1,195 @@
+#include "Compression.h"
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+constexpr size_t kMinMatch = 4;
+constexpr int kHashBits = 12;
+constexpr size_t kMaxOffset = 0xffff;
+// Matches are not looked for this close to the end, so the 4-byte reads
+// of the match search stay inside the input
+constexpr size_t kTailLiterals = 8;
+
+inline uint32_t read32(const char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t hash4(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - kHashBits);
+}
+
+inline void put_length(char*& out, size_t length) {
+    for (; length >= 255; length -= 255) {
+        *out++ = char(255);
+    }
+    *out++ = char(length);
+}
+
+inline bool get_length(const uint8_t*& in, const uint8_t* end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (in == end) return false;
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Token, extended literal length and the literals
+void put_literals(char*& out, const char* literals, size_t count, size_t match_length) {
+    char* token = out++;
+    *token = char((count >= 15 ? 15 : count) << 4 |
+                  (match_length >= 15 + kMinMatch ? 15 : match_length ? match_length - kMinMatch : 0));
+    if (count >= 15) put_length(out, count - 15);
+    std::memcpy(out, literals, count);
+    out += count;
+}
+
+}  // namespace
+
+void lz_compress(const char* data, size_t size, std::string& out) {
+    size_t start = out.size();
+    // Worst case: all literals, one length byte per 255 of them
+    out.resize(start + 4 + size + size / 255 + 16);
+    char* op = &out[start];
+    uint32_t raw = size;
+    for (int i = 0; i < 4; ++i) {
+        *op++ = char(raw >> (8 * i));
+    }
+
+    std::array<uint32_t, 1 << kHashBits> table{};  // Position + 1 of the last sequence with each hash
+    const char* anchor = data;  // First byte not yet emitted
+    const char* end = data + size;
+    if (size > kTailLiterals + kMinMatch) {
+        const char* limit = end - kTailLiterals;
+        const char* ip = data;
+        unsigned misses = 0;
+        while (ip < limit) {
+            uint32_t sequence = read32(ip);
+            uint32_t& slot = table[hash4(sequence)];
+            size_t previous = slot;
+            slot = ip - data + 1;
+            const char* candidate = data + (previous ? previous - 1 : 0);
+            if (!previous || size_t(ip - candidate) > kMaxOffset || read32(candidate) != sequence) {
+                // Speed through incompressible stretches
+                ip += 1 + (misses++ >> 5);
+                continue;
+            }
+            misses = 0;
+
+            // Extend backwards over literals and forwards to the limit
+            while (ip > anchor && candidate > data && ip[-1] == candidate[-1]) {
+                --ip;
+                --candidate;
+            }
+            const char* match_end = ip + kMinMatch;
+            const char* from = candidate + kMinMatch;
+            while (match_end < limit && *match_end == *from) {
+                ++match_end;
+                ++from;
+            }
+            size_t match_length = match_end - ip;
+
+            put_literals(op, anchor, ip - anchor, match_length);
+            uint16_t offset = ip - candidate;
+            *op++ = char(offset);
+            *op++ = char(offset >> 8);
+            if (match_length >= 15 + kMinMatch) put_length(op, match_length - 15 - kMinMatch);
+
+            ip = anchor = match_end;
+            if (ip < limit) {
+                table[hash4(read32(ip - 2))] = ip - 2 - data + 1;
+            }
+        }
+    }
+    put_literals(op, anchor, end - anchor, 0);
+    out.resize(op - out.data());
+}
+
+bool lz_decompress(const char* data, size_t size, std::string& out, size_t max_size) {
+    if (size < 4) return false;
+    const uint8_t* ip = reinterpret_cast<const uint8_t*>(data);
+    const uint8_t* end = ip + size;
+    size_t raw = size_t(ip[0]) | size_t(ip[1]) << 8 | size_t(ip[2]) << 16 | size_t(ip[3]) << 24;
+    ip += 4;
+    if (raw > max_size) return false;
+
+    out.resize(raw);
+    char* op = &out[0];
+    char* const out_start = op;
+    char* const out_end = op + raw;
+    while (true) {
+        if (ip == end) return false;
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !get_length(ip, end, literals)) return false;
+        if (literals > size_t(end - ip) || literals > size_t(out_end - op)) return false;
+        std::memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == end) return op == out_end;  // Literals-only last sequence
+
+        if (end - ip < 2) return false;
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        size_t length = (token & 15) + kMinMatch;
+        if ((token & 15) == 15 && !get_length(ip, end, length)) return false;
+        if (offset == 0 || offset > size_t(op - out_start) || length > size_t(out_end - op)) return false;
+
+        const char* from = op - offset;
+        if (offset >= length) {
+            std::memcpy(op, from, length);
+            op += length;
+        } else {
+            // Overlapping: the match repeats its last offset bytes
+            for (size_t i = 0; i < length; ++i) {
+                *op++ = from[i];
+            }
+        }
+    }
+}
+
+// Order-0 entropy of the sample, in bits per byte. 512 bytes of uniform
+// random data measure about 7.6; text is around 5 and sparse binary lower.
+bool lz_worth_trying(const char* data, size_t size) {
+    constexpr size_t kWindows = 4;
+    constexpr size_t kWindowBytes = 128;
+    std::array<uint16_t, 256> counts{};
+    size_t sampled = 0;
+    if (size <= kWindows * kWindowBytes) {
+        for (size_t i = 0; i < size; ++i) {
+            ++counts[uint8_t(data[i])];
+        }
+        sampled = size;
+    } else {
+        size_t stride = (size - kWindowBytes) / (kWindows - 1);
+        for (size_t w = 0; w < kWindows; ++w) {
+            const char* window = data + w * stride;
+            for (size_t i = 0; i < kWindowBytes; ++i) {
+                ++counts[uint8_t(window[i])];
+            }
+        }
+        sampled = kWindows * kWindowBytes;
+    }
+    if (sampled == 0) return false;
+
+    // count * log2(count) for every count the sample can produce
+    static const auto weights = [] {
+        std::array<float, kWindows * kWindowBytes + 1> table{};
+        for (size_t count = 1; count < table.size(); ++count) {
+            table[count] = count * std::log2(double(count));
+        }
+        return table;
+    }();
+    double sum = 0;
+    for (uint16_t count : counts) {
+        sum += weights[count];
+    }
+    double bits = std::log2(double(sampled)) - sum / sampled;
+    return bits < 7.0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Self-contained LZ77 codec in the LZ4 style, tuned for speed over ratio:
+// one hash probe per position, no entropy coding, and a decoder that is
+// mostly memcpy. Used for message payloads on compressed topics.
+//
+// Format: u32 little-endian decompressed size, then sequences of a token
+// byte (literal length in the high nibble, match length - 4 in the low
+// nibble; 15 means more length bytes follow, each adding up to 255), the
+// literals, and a u16 little-endian match offset. The last sequence has
+// literals only.
+
+// Appends the compressed form of data to out
+void lz_compress(const char* data, size_t size, std::string& out);
+
+// Replaces out with the decompressed data; false if the input is malformed
+// or would decompress to more than max_size bytes
+bool lz_decompress(const char* data, size_t size, std::string& out, size_t max_size = 64 << 20);
+
+// Quick check on up to 512 sampled bytes: false if their byte distribution
+// is close to uniform (already compressed, encrypted or noisy data), where
+// compressing would cost time and save nothing
+bool lz_worth_trying(const char* data, size_t size);
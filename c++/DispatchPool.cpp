@@ -0,0 +1,182 @@
+#include "DispatchPool.h"
+#include <iostream>
+
+using json = nlohmann::json;
+
+thread_local const DispatchPool* DispatchPool::current_pool_ = nullptr;
+thread_local size_t DispatchPool::current_index_ = 0;
+
+DispatchPool::DispatchPool(size_t threads, size_t strand_limit, ThreadMain thread_main)
+    : strand_limit_(std::max<size_t>(1, strand_limit)) {
+    for (size_t i = 0; i < std::max<size_t>(1, threads); ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i]->thread = std::thread([this, i, thread_main] {
+            if (thread_main) {
+                thread_main(i, [this, i] { work(i); });
+            } else {
+                work(i);
+            }
+        });
+    }
+}
+
+DispatchPool::~DispatchPool() {
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        running_ = false;
+    }
+    idle_cv_.notify_all();
+    {
+        // Release posters waiting for room
+        std::lock_guard<std::mutex> lock(strands_mutex_);
+        for (auto& [_, strand] : strands_) {
+            { std::lock_guard<std::mutex> strand_lock(strand->mutex_); }
+            strand->not_full_.notify_all();
+        }
+    }
+    for (auto& worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+DispatchPool::Strand* DispatchPool::strand(const std::string& key) {
+    std::lock_guard<std::mutex> lock(strands_mutex_);
+    auto& strand = strands_[key];
+    if (!strand) {
+        strand = std::make_unique<Strand>();
+    }
+    return strand.get();
+}
+
+void DispatchPool::post(Strand* strand, Task task) {
+    std::unique_lock<std::mutex> lock(strand->mutex_);
+    if (current_pool_ != this && strand->tasks_.size() >= strand_limit_) {
+        ++blocked_posts_;
+        strand->not_full_.wait(lock, [&] { return strand->tasks_.size() < strand_limit_ || !running_; });
+    }
+    if (!running_) return;
+    strand->tasks_.push_back(std::move(task));
+    if (strand->scheduled_) return; // The running or queued turn picks it up
+    strand->scheduled_ = true;
+    lock.unlock();
+    schedule(strand);
+}
+
+// Workers requeue on their own deque; other threads spread strands round-robin
+void DispatchPool::schedule(Strand* strand) {
+    size_t target = current_pool_ == this ? current_index_ : next_worker_++ % workers_.size();
+    {
+        std::lock_guard<std::mutex> lock(workers_[target]->mutex);
+        workers_[target]->ready.push_back(strand);
+    }
+    ++queued_;
+    if (sleepers_ > 0) {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        idle_cv_.notify_one();
+    }
+}
+
+DispatchPool::Strand* DispatchPool::take(size_t self) {
+    {
+        Worker& own = *workers_[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.ready.empty()) {
+            Strand* strand = own.ready.front();
+            own.ready.pop_front();
+            return strand;
+        }
+    }
+    for (size_t i = 1; i < workers_.size(); ++i) {
+        Worker& victim = *workers_[(self + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.ready.empty()) {
+            Strand* strand = victim.ready.back();
+            victim.ready.pop_back();
+            ++workers_[self]->steals;
+            return strand;
+        }
+    }
+    return nullptr;
+}
+
+void DispatchPool::run_strand(Strand* strand, Worker& worker) {
+    for (int n = 0; n < kStrandBatch; ++n) {
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock(strand->mutex_);
+            if (strand->tasks_.empty()) {
+                strand->scheduled_ = false;
+                return;
+            }
+            task = std::move(strand->tasks_.front());
+            strand->tasks_.pop_front();
+        }
+        strand->not_full_.notify_one();
+
+        try {
+            task();
+        } catch (const std::exception& e) {
+            std::cerr << "Exception in subscriber callback: " << e.what() << "\n";
+        } catch (...) {
+            std::cerr << "Exception in subscriber callback.\n";
+        }
+        ++strand->executed_;
+        ++worker.executed;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(strand->mutex_);
+        if (strand->tasks_.empty()) {
+            strand->scheduled_ = false;
+            return;
+        }
+    }
+    schedule(strand); // Back of the line; an idle worker may steal it
+}
+
+void DispatchPool::work(size_t self) {
+    current_pool_ = this;
+    current_index_ = self;
+
+    while (running_) {
+        if (Strand* strand = take(self)) {
+            --queued_;
+            run_strand(strand, *workers_[self]);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(idle_mutex_);
+        ++sleepers_;
+        if (queued_ == 0 && running_) {
+            ++sleeps_;
+            idle_cv_.wait(lock, [this] { return queued_ > 0 || !running_; });
+        }
+        --sleepers_;
+    }
+    current_pool_ = nullptr;
+}
+
+json DispatchPool::to_json() const {
+    uint64_t executed = 0, steals = 0;
+    for (const auto& worker : workers_) {
+        executed += worker->executed;
+        steals += worker->steals;
+    }
+    size_t strands;
+    {
+        std::lock_guard<std::mutex> lock(strands_mutex_);
+        strands = strands_.size();
+    }
+    return {
+        {"threads", workers_.size()},
+        {"strands", strands},
+        {"executed", executed},
+        {"steals", steals},
+        {"blocked_posts", blocked_posts_.load()},
+        {"sleeps", sleeps_.load()}
+    };
+}
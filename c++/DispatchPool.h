@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "json.hpp"
+
+// Work-stealing pool for subscriber callbacks. Tasks are posted to a strand
+// (one per topic); a strand runs its tasks one at a time in post order, while
+// different strands run in parallel. A strand with work is queued on one
+// worker; idle workers steal queued strands from the others, so a saturated
+// topic keeps one core busy without holding up light topics behind it.
+class DispatchPool {
+public:
+    using Task = std::function<void()>;
+    // Wraps each worker's loop, e.g. to name and place the thread
+    using ThreadMain = std::function<void(size_t worker, const std::function<void()>& loop)>;
+
+    class Strand {
+    public:
+        uint64_t executed() const { return executed_.load(std::memory_order_relaxed); }
+
+    private:
+        friend class DispatchPool;
+        std::mutex mutex_;
+        std::condition_variable not_full_;
+        std::deque<Task> tasks_;
+        bool scheduled_ = false;  // Queued on a worker or running
+        std::atomic<uint64_t> executed_{0};
+    };
+
+    // strand_limit bounds the tasks waiting per strand: post() from outside
+    // the pool blocks while the strand is full, which pushes back on the
+    // connection feeding it. Posts from the pool's own workers never block.
+    DispatchPool(size_t threads, size_t strand_limit, ThreadMain thread_main = {});
+    ~DispatchPool();  // Tasks not yet run are dropped
+
+    DispatchPool(const DispatchPool&) = delete;
+    DispatchPool& operator=(const DispatchPool&) = delete;
+
+    // The strand for a key; strands live as long as the pool
+    Strand* strand(const std::string& key);
+
+    void post(Strand* strand, Task task);
+
+    // {"threads", "strands", "executed", "steals", "blocked_posts", "sleeps"}
+    nlohmann::json to_json() const;
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Strand*> ready;  // Owner takes from the front, thieves from the back
+        std::thread thread;
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> steals{0};
+    };
+
+    // Tasks a worker runs from one strand before giving the others a turn
+    static constexpr int kStrandBatch = 64;
+
+    const size_t strand_limit_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<bool> running_{true};
+
+    std::unordered_map<std::string, std::unique_ptr<Strand>> strands_;
+    mutable std::mutex strands_mutex_;
+
+    // Idle workers sleep until a strand is queued
+    std::atomic<int64_t> queued_{0};  // Strands sitting in the ready deques
+    std::atomic<int> sleepers_{0};
+    std::mutex idle_mutex_;
+    std::condition_variable idle_cv_;
+
+    std::atomic<uint64_t> next_worker_{0};
+    std::atomic<uint64_t> blocked_posts_{0};
+    std::atomic<uint64_t> sleeps_{0};
+
+    // The pool and worker index of the calling thread, if it is a worker
+    static thread_local const DispatchPool* current_pool_;
+    static thread_local size_t current_index_;
+
+    void schedule(Strand* strand);
+    Strand* take(size_t self);
+    void run_strand(Strand* strand, Worker& worker);
+    void work(size_t self);
+};
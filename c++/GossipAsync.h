@@ -0,0 +1,263 @@
+#pragma once
+
+// Coroutine API on top of GossipNode (needs -std=c++20):
+//
+//     gossip::Task camera_feed(GossipNode& node) {
+//         gossip::Subscription frames(node, "site/+/camera/#");
+//         while (true) {
+//             gossip::Message frame = co_await frames.next();
+//             co_await gossip::publish_async(node, "thumbnails", shrink(frame.content));
+//         }
+//     }
+//
+// Without an executor, a coroutine resumes on the thread that completed the
+// operation: a connection handler thread for next(), the I/O engine thread
+// for connect(). Both are shared with the rest of the node, so coroutines that
+// block or do heavy work should pass an executor (a thread pool, a GUI loop).
+
+#include "GossipNode.h"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace gossip {
+
+using Executor = std::function<void(std::function<void()>)>;
+
+inline void resume_on(const Executor& executor, std::coroutine_handle<> handle) {
+    if (executor) {
+        executor([handle] { handle.resume(); });
+    } else {
+        handle.resume();
+    }
+}
+
+// Fire-and-forget coroutine: starts right away and frees itself when done
+struct Task {
+    struct promise_type {
+        Task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {
+            try {
+                throw;
+            } catch (const std::exception& e) {
+                std::cerr << "Unhandled exception in gossip::Task: " << e.what() << "\n";
+            } catch (...) {
+                std::cerr << "Unhandled exception in gossip::Task.\n";
+            }
+        }
+    };
+};
+
+// Completes once the frame has been handed to the kernel for every
+// interested peer
+class PublishAwaitable {
+public:
+    PublishAwaitable(GossipNode& node, std::string topic, std::string content, Executor executor)
+        : node_(node), topic_(std::move(topic)), content_(std::move(content)), executor_(std::move(executor)) {}
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) {
+        node_.publish(topic_, content_);
+        if (!executor_) {
+            return false; // Continue inline
+        }
+        executor_([handle] { handle.resume(); });
+        return true;
+    }
+    void await_resume() const noexcept {}
+
+private:
+    GossipNode& node_;
+    std::string topic_;
+    std::string content_;
+    Executor executor_;
+};
+
+inline PublishAwaitable publish_async(GossipNode& node, std::string topic, std::string content, Executor executor = {}) {
+    return PublishAwaitable(node, std::move(topic), std::move(content), std::move(executor));
+}
+
+// Acknowledged publish; yields true once every interested peer delivered it
+class AckAwaitable {
+public:
+    AckAwaitable(GossipNode& node, std::string topic, std::string content,
+                 std::chrono::milliseconds timeout, Executor executor)
+        : node_(node), topic_(std::move(topic)), content_(std::move(content)),
+          timeout_(timeout), executor_(std::move(executor)) {}
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) {
+        // The callback owns the strings the send still reads. An outcome
+        // known inside publish_acked (failed connect, dropped message) must
+        // not resume the coroutine there, on a stack holding node locks: the
+        // callback only records it and the coroutine continues from here.
+        auto state = std::make_shared<State>();
+        state->topic = std::move(topic_);
+        state->content = std::move(content_);
+        node_.publish_acked(state->topic, state->content, timeout_, [this, handle, state](bool delivered) {
+            delivered_ = delivered;
+            if (state->suspended.exchange(true)) {
+                resume_on(executor_, handle);
+            }
+        });
+        if (!state->suspended.exchange(true)) {
+            return true; // The callback resumes
+        }
+        if (!executor_) {
+            return false; // Continue inline
+        }
+        executor_([handle] { handle.resume(); });
+        return true;
+    }
+    bool await_resume() const noexcept { return delivered_; }
+
+private:
+    GossipNode& node_;
+    std::string topic_;
+    std::string content_;
+    std::chrono::milliseconds timeout_;
+    Executor executor_;
+    bool delivered_ = false;
+
+    struct State {
+        std::string topic;
+        std::string content;
+        std::atomic<bool> suspended{false};  // The second of await_suspend and the callback to set it resumes
+    };
+};
+
+inline AckAwaitable publish_acked(GossipNode& node, std::string topic, std::string content,
+                                  std::chrono::milliseconds timeout = std::chrono::seconds(5), Executor executor = {}) {
+    return AckAwaitable(node, std::move(topic), std::move(content), timeout, std::move(executor));
+}
+
+// Opens the pooled connection to a peer ahead of the first publish; yields
+// whether the peer accepted the connection
+class ConnectAwaitable {
+public:
+    ConnectAwaitable(GossipNode& node, std::string ip, int port, Executor executor)
+        : node_(node), ip_(std::move(ip)), port_(port), executor_(std::move(executor)) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+        // May complete (and resume) before connect_async returns; nothing
+        // here touches *this afterwards.
+        node_.connect_async(ip_, port_, [this, handle](bool connected) {
+            connected_ = connected;
+            resume_on(executor_, handle);
+        });
+    }
+    bool await_resume() const noexcept { return connected_; }
+
+private:
+    GossipNode& node_;
+    std::string ip_;
+    int port_;
+    Executor executor_;
+    bool connected_ = false;
+};
+
+inline ConnectAwaitable connect(GossipNode& node, std::string ip, int port, Executor executor = {}) {
+    return ConnectAwaitable(node, std::move(ip), port, std::move(executor));
+}
+
+struct Message {
+    std::string topic;
+    std::string content;
+};
+
+// A subscription read with co_await next() instead of a callback. Messages
+// arriving while nobody awaits are queued, up to max_queued (the oldest are
+// dropped beyond that). One coroutine may await next() at a time, and the
+// Subscription must outlive a pending next().
+class Subscription {
+    struct State {
+        std::mutex mutex;
+        std::deque<Message> queue;
+        std::coroutine_handle<> waiter;
+        Message* slot = nullptr;  // Where the waiter wants its message
+        size_t max_queued;
+        uint64_t dropped = 0;
+        Executor executor;
+    };
+
+public:
+    Subscription(GossipNode& node, const std::string& topic, Executor executor = {}, size_t max_queued = 1024)
+        : node_(node), state_(std::make_shared<State>()) {
+        state_->max_queued = max_queued;
+        state_->executor = std::move(executor);
+        id_ = node_.subscribe(topic, [state = state_](const std::string& message_topic, const std::string& content) {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            if (state->waiter) {
+                *state->slot = Message{message_topic, content};
+                auto waiter = std::exchange(state->waiter, nullptr);
+                lock.unlock();
+                resume_on(state->executor, waiter);
+                return;
+            }
+            if (state->queue.size() >= state->max_queued) {
+                state->queue.pop_front();
+                ++state->dropped;
+            }
+            state->queue.push_back(Message{message_topic, content});
+        });
+    }
+
+    ~Subscription() { node_.unsubscribe(id_); }
+
+    Subscription(const Subscription&) = delete;
+    Subscription& operator=(const Subscription&) = delete;
+
+    class NextAwaitable {
+    public:
+        explicit NextAwaitable(State& state) : state_(state) {}
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle) {
+            std::lock_guard<std::mutex> lock(state_.mutex);
+            if (!state_.queue.empty()) {
+                message_ = std::move(state_.queue.front());
+                state_.queue.pop_front();
+                return false;
+            }
+            state_.waiter = handle;
+            state_.slot = &message_;
+            return true;
+        }
+        Message await_resume() { return std::move(message_); }
+
+    private:
+        State& state_;
+        Message message_;
+    };
+
+    NextAwaitable next() { return NextAwaitable(*state_); }
+
+    uint64_t dropped() const {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        return state_->dropped;
+    }
+
+private:
+    GossipNode& node_;
+    std::shared_ptr<State> state_;
+    GossipNode::SubscriptionId id_;
+};
+
+} // namespace gossip
+
+#endif
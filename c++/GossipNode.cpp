@@ -1,4 +1,6 @@
 #include "GossipNode.h"
+#include "Compression.h"
+#include "Hash.h"
 #include <unistd.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -6,11 +8,218 @@
 #include <iostream>
 #include <netdb.h> // for gethostbyname
 #include <signal.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
 
 using json = nlohmann::json;
 
-GossipNode::GossipNode(const std::string& host, int port)
-    : host_(host), port_(port) {
+namespace {
+
+// Membership digest: a 16-ary Merkle tree over 256 leaf buckets. Each peer
+// record lands in the bucket named by the first two hex digits of the hash of
+// "ip:port"; paths are hex prefixes ("" is the root, "3", "3a", ...).
+constexpr size_t kDigestDepth = 2;
+constexpr int kDigestFanout = 16;
+const char* kHexDigits = "0123456789abcdef";
+
+std::string bucket_of(const json& node) {
+    std::string key = node["IP"].get<std::string>() + ":" + std::to_string(node["port"].get<int>());
+    uint64_t h = fnv1a(key);
+    std::string path;
+    for (size_t i = 0; i < kDigestDepth; ++i) {
+        path += kHexDigits[(h >> (60 - 4 * i)) & 0xf];
+    }
+    return path;
+}
+
+uint64_t entry_hash(const json& node) {
+    std::vector<std::string> topics = node["subscribed_topics"];
+    std::sort(topics.begin(), topics.end());
+    std::string key = node["IP"].get<std::string>() + ":" + std::to_string(node["port"].get<int>());
+    for (const auto& topic : topics) {
+        key += "\n" + topic;
+    }
+    if (node.contains("topic_filter")) {
+        key += "\n" + node["topic_filter"]["data"].get<std::string>();
+    }
+    if (node.contains("capabilities")) {
+        key += "\n" + node["capabilities"].dump();
+    }
+    if (node.contains("topics_version")) {
+        key += "\n" + std::to_string(node["topics_version"].get<uint64_t>());
+    }
+    return mix(fnv1a(key));
+}
+
+struct MembershipDigest {
+    std::map<std::string, uint64_t> hashes;          // every non-empty tree node
+    std::map<std::string, json> entries;             // leaf path -> array of records
+
+    // Built from the wire form (gossip_info) so peers hash records identically
+    explicit MembershipDigest(const json& info) {
+        std::vector<json> records{info["self"]};
+        for (const auto& node : info["known_nodes"]) {
+            records.push_back(node);
+        }
+        for (const auto& node : records) {
+            std::string leaf = bucket_of(node);
+            hashes[leaf] += entry_hash(node);
+            if (!entries.count(leaf)) entries[leaf] = json::array();
+            json record = {
+                {"IP", node["IP"]},
+                {"port", node["port"]},
+                {"subscribed_topics", node["subscribed_topics"]}
+            };
+            if (node.contains("topic_filter")) record["topic_filter"] = node["topic_filter"];
+            if (node.contains("capabilities")) record["capabilities"] = node["capabilities"];
+            if (node.contains("topics_version")) record["topics_version"] = node["topics_version"];
+            entries[leaf].push_back(record);
+        }
+        for (size_t level = kDigestDepth; level > 0; --level) {
+            std::map<std::string, std::string> parents;
+            for (const auto& [path, hash] : hashes) {
+                if (path.size() != level) continue;
+                parents[path.substr(0, level - 1)];
+            }
+            for (const auto& [parent, _] : parents) {
+                std::string concatenated;
+                for (uint64_t h : children(parent)) {
+                    concatenated += std::to_string(h) + ",";
+                }
+                hashes[parent] = fnv1a(concatenated);
+            }
+        }
+    }
+
+    uint64_t hash(const std::string& path) const {
+        auto it = hashes.find(path);
+        return it == hashes.end() ? 0 : it->second;
+    }
+
+    std::vector<uint64_t> children(const std::string& path) const {
+        std::vector<uint64_t> result;
+        for (int d = 0; d < kDigestFanout; ++d) {
+            result.push_back(hash(path + kHexDigits[d]));
+        }
+        return result;
+    }
+};
+
+// Frames for interned topics start with this byte instead of "POST /"
+constexpr char kInternedFrame = '\x01';
+// Same, followed by the varint sequence number after the topic ID
+constexpr char kSequencedFrame = '\x02';
+// Sequenced frame the receiver acknowledges
+constexpr char kAckedFrame = '\x03';
+// Prefix carrying the deadline (varint Unix milliseconds) of the frame after it
+constexpr char kDeadlinePrefix = '\x04';
+// Prefix marking the content of the interned frame after it as LZ-compressed;
+// follows the deadline prefix if both are present
+constexpr char kCompressedPrefix = '\x05';
+
+// SO_PRIORITY per traffic class: Control shares the interactive band with
+// nothing else, Bulk goes to the lowest band of the default pfifo_fast qdisc
+int socket_priority(Priority priority) {
+    switch (priority) {
+        case Priority::Control: return 6;  // TC_PRIO_INTERACTIVE
+        case Priority::High:    return 4;  // TC_PRIO_INTERACTIVE_BULK
+        case Priority::Normal:  return 0;  // TC_PRIO_BESTEFFORT
+        default:                return 2;  // TC_PRIO_BULK
+    }
+}
+
+void set_priority(int fd, Priority priority) {
+    int value = socket_priority(priority);
+    setsockopt(fd, SOL_SOCKET, SO_PRIORITY, &value, sizeof(value));
+}
+
+// Value of a header in the header block of an HTTP-style message, or ""
+std::string header_value(const std::string& headers, const std::string& name) {
+    std::string prefix = "\r\n" + name + ": ";
+    size_t pos = headers.find(prefix);
+    if (pos == std::string::npos) return "";
+    pos += prefix.size();
+    return headers.substr(pos, headers.find("\r\n", pos) - pos);
+}
+
+void append_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += char((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+bool read_varint(const std::string& in, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        uint8_t byte = in[pos++];
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// System-wide TcpExt ListenOverflows counter (accept queue full, SYN dropped)
+uint64_t read_listen_overflows() {
+    std::ifstream netstat("/proc/net/netstat");
+    std::string header, values;
+    while (std::getline(netstat, header) && std::getline(netstat, values)) {
+        if (header.rfind("TcpExt:", 0) != 0) continue;
+        std::istringstream names(header), counts(values);
+        std::string name, count;
+        while (names >> name && counts >> count) {
+            if (name == "ListenOverflows") return std::stoull(count);
+        }
+    }
+    return 0;
+}
+
+// One in-flight GET /info exchange, driven by the I/O engine
+struct InfoQuery {
+    int fd = -1;
+    std::string request;
+    size_t sent = 0;
+    std::string response;
+    uint64_t timer = 0;
+
+    ~InfoQuery() {
+        if (fd >= 0) close(fd);
+    }
+};
+
+constexpr auto kQueryTimeout = std::chrono::seconds(2);
+
+// Send one framed request and read one framed response on a blocking socket.
+bool exchange(int sock, const std::string& request, std::string& response) {
+    if (send(sock, request.c_str(), request.size(), 0) != (ssize_t)request.size()) {
+        return false;
+    }
+    response.clear();
+    char buffer[4096];
+    size_t end_marker;
+    while ((end_marker = response.find("END238973")) == std::string::npos) {
+        ssize_t bytes = recv(sock, buffer, sizeof(buffer), 0);
+        if (bytes <= 0) return false;
+        response.append(buffer, bytes);
+    }
+    response.erase(end_marker);
+    return true;
+}
+
+} // namespace
+
+GossipNode::GossipNode(const std::string& host, int port, const GossipConfig& config)
+    : host_(host), port_(port), config_(config) {
 
     // Ignore SIGPIPE globally
     static bool signal_handled = false;
@@ -19,91 +228,326 @@ GossipNode::GossipNode(const std::string& host, int port)
         signal_handled = true;
     }
 
-    info_["self"] = {
-        {"IP", host_},
-        {"port", port_},
-        {"subscribed_topics", json::array()}
-    };
-    info_["known_nodes"] = json::array();
+    // Random per process, so a restarted publisher starts fresh streams
+    std::random_device rd;
+    std::ostringstream session;
+    session << std::hex << std::setfill('0') << std::setw(8) << rd() << std::setw(8) << rd();
+    session_id_ = session.str();
+
+    membership_.update([&](Membership& m) {
+        m.self.ip = host_;
+        m.self.port = port_;
+        // Starts at the clock so a restarted node's list supersedes its old one
+        m.self.topics_version = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        m.self.capabilities = {"topic_ids", "seq", "acks", "credits", "deadlines", "lz"};
+        if (config_.last_value_cache_bytes > 0) {
+            m.self.capabilities.push_back("last_values");
+        }
+        return true;
+    });
 
+    engine_ = std::make_unique<IoEngine>([this](const std::function<void()>& loop) {
+        place_current_thread("gossip-io", config_.io_threads);
+        ThreadStats::Scope scope(thread_stats_, "io");
+        loop();
+    });
+    auto limited = [](const RateLimit& limit) {
+        return limit.messages_per_second > 0 || limit.bytes_per_second > 0;
+    };
+    if (limited(config_.node_rate_limit)) {
+        const RateLimit& limit = config_.node_rate_limit;
+        node_limiter_ = std::make_unique<RateLimiter>(limit.messages_per_second, limit.bytes_per_second,
+                                                      limit.burst_seconds);
+    }
+    rate_limited_ = node_limiter_ || !config_.topic_rate_limits.empty() || limited(config_.peer_rate_limit) ||
+                    !config_.peer_rate_limits.empty();
+    index_patterns();
+    if (config_.dispatch_threads > 0) {
+        dispatch_ = std::make_unique<DispatchPool>(
+            config_.dispatch_threads, config_.dispatch_queue_limit,
+            [this](size_t worker, const std::function<void()>& loop) {
+                place_current_thread("gossip-dispatch" + std::to_string(worker), config_.callback_threads);
+                ThreadStats::Scope scope(thread_stats_, "callback");
+                loop();
+            });
+    }
     bind_with_retry();
-    server_thread_ = std::thread(&GossipNode::start_server, this);
-    std::thread(&GossipNode::update_known_nodes_periodically, this).detach();  // <<-- Add this
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < listeners_.size(); ++i) {
+        ThreadPlacement placement = config_.io_threads;
+        if (placement.cpus.empty() && listeners_.size() > 1) {
+            // Handler threads inherit the affinity of the thread that creates them
+            placement.cpus = {int(i % cpus)};
+        }
+        Listener& listener = *listeners_[i];
+        listener.thread = start_thread("io", "gossip-accept" + std::to_string(i), placement,
+                                       [this, &listener] { start_server(listener); });
+    }
+    gossip_thread_ = start_thread("gossip", "gossip-refresh", config_.gossip_threads,
+                                  [this] { update_known_nodes_periodically(); });
+    repair_thread_ = start_thread("gossip", "gossip-repair", config_.gossip_threads,
+                                  [this] { repair_membership_periodically(); });
+    sender_thread_ = start_thread("io", "gossip-sender", config_.io_threads, [this] { drain_ingress(); });
+    if (!config_.topic_log_dir.empty()) {
+        log_thread_ = start_thread("io", "gossip-log", config_.io_threads, [this] { write_logs(); });
+    }
+}
+
+std::thread GossipNode::start_thread(const std::string& role, const std::string& name,
+                                     const ThreadPlacement& placement, std::function<void()> body) {
+    return std::thread([this, role, name, placement, body = std::move(body)] {
+        place_current_thread(name, placement);
+        ThreadStats::Scope scope(thread_stats_, role);
+        body();
+    });
 }
 
 GossipNode::~GossipNode() {
-    close(server_fd_);
-    if (server_thread_.joinable()) {
-        server_thread_.join();
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex_);
+        running_ = false;
     }
+    stop_cv_.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(sender_mutex_);
+    }
+    sender_cv_.notify_all(); // Queued messages not yet sent are dropped
+    {
+        std::lock_guard<std::mutex> lock(log_mutex_);
+    }
+    log_cv_.notify_all(); // Queued log appends are written first
+
+    for (auto& listener : listeners_) {
+        shutdown(listener->fd, SHUT_RDWR); // wakes the blocked accept()
+        close(listener->fd);
+        if (listener->thread.joinable()) {
+            listener->thread.join();
+        }
+    }
+    {
+        // Handlers run callbacks and use the engine and the dispatch pool
+        std::unique_lock<std::mutex> lock(clients_mutex_);
+        for (int fd : client_fds_) {
+            shutdown(fd, SHUT_RDWR); // Wakes the blocked recv()
+        }
+        clients_cv_.wait(lock, [this] { return client_fds_.empty(); });
+    }
+    for (auto* t : {&gossip_thread_, &repair_thread_, &sender_thread_, &log_thread_}) {
+        if (t->joinable()) {
+            t->join();
+        }
+    }
+    dispatch_.reset(); // Drops callbacks not yet run
+    engine_->stop(); // Its handlers use engine_ until the thread is gone
+    engine_.reset(); // Drops in-flight queries
 
     std::lock_guard<std::mutex> lock(conn_mutex_);
-    for (auto& [_, sock] : socket_pool_) {
-        close(sock);
+    for (auto& [_, conn] : socket_pool_) {
+        fail_pending(*conn);
     }
-    socket_pool_.clear();
+    socket_pool_.clear(); // Closes the sockets
 }
 
 void GossipNode::bind_with_retry() {
-    server_fd_ = socket(AF_INET, SOCK_STREAM, 0);
-    int opt = 1;
-    setsockopt(server_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    int count = std::max(1, config_.listeners);
+    for (int i = 0; i < count; ++i) {
+        auto listener = std::make_unique<Listener>();
+        listener->fd = socket(AF_INET, SOCK_STREAM, 0);
+        int opt = 1;
+        setsockopt(listener->fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        if (count > 1) {
+            // The kernel spreads incoming connections across the sockets
+            setsockopt(listener->fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+        }
 
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port_);
-    addr.sin_addr.s_addr = inet_addr(host_.c_str());
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port_);
+        addr.sin_addr.s_addr = inet_addr(host_.c_str());
+
+        while (bind(listener->fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            std::cerr << "Failed to bind, retrying in 5s...\n";
+            sleep(5);
+        }
 
-    while (bind(server_fd_, (sockaddr*)&addr, sizeof(addr)) < 0) {
-        std::cerr << "Failed to bind, retrying in 5s...\n";
-        sleep(5);
+        listen(listener->fd, config_.listen_backlog);
+        listeners_.push_back(std::move(listener));
     }
 
-    listen(server_fd_, 5);
-    std::cout << "Listening on " << host_ << ":" << port_ << std::endl;
+    started_at_ = std::chrono::steady_clock::now();
+    listen_overflows_at_start_ = read_listen_overflows();
+    std::cout << "Listening on " << host_ << ":" << port_;
+    if (count > 1) std::cout << " (" << count << " listeners)";
+    std::cout << std::endl;
 }
 
-void GossipNode::start_server() {
-    while (true) {
+void GossipNode::start_server(Listener& listener) {
+    while (running_) {
         sockaddr_in client_addr{};
         socklen_t client_len = sizeof(client_addr);
-        int client_fd = accept(server_fd_, (sockaddr*)&client_addr, &client_len);
-        if (client_fd >= 0) {
-            std::thread(&GossipNode::handle_client, this, client_fd).detach();
+        int client_fd = accept(listener.fd, (sockaddr*)&client_addr, &client_len);
+        if (client_fd < 0) {
+            continue;
+        }
+        ++listener.accepts;
+
+        // On a listening socket tcpi_unacked is the accept queue length and
+        // tcpi_sacked its limit
+        tcp_info info{};
+        socklen_t info_len = sizeof(info);
+        if (getsockopt(listener.fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0) {
+            uint64_t queued = info.tcpi_unacked + 1; // plus the one just accepted
+            if (queued > listener.peak_queue) listener.peak_queue = queued;
+            if (queued >= info.tcpi_sacked) ++listener.backlog_full;
         }
+
+        {
+            // Registered here so the destructor, which joins this thread
+            // first, sees every handler
+            std::lock_guard<std::mutex> lock(clients_mutex_);
+            client_fds_.insert(client_fd);
+        }
+        start_thread("callback", "gossip-cb", config_.callback_threads,
+                     [this, client_fd] { handle_client(client_fd); }).detach();
     }
 }
 
 void GossipNode::handle_client(int client_fd) {
-    char buffer[1024];
+    char buffer[64 * 1024];
     std::string data;
+    size_t scan_from = 0; // Bytes of data already searched for the marker
     ssize_t received;
+    std::vector<TopicSlot> topic_slots; // Indexed by the peer's topic IDs
+    uint64_t acked_frames = 0, acks_sent = 0;
+    auto client = std::make_shared<InboundConnection>();
+    client->fd = client_fd;
+    bool control = false; // Membership queries: answer on the control class
+    bool misbehaving = false; // Set to drop the connection
 
     try {
         while ((received = recv(client_fd, buffer, sizeof(buffer), 0)) > 0) {
             data.append(buffer, received);
 
-            size_t end_marker;
-            while ((end_marker = data.find("END238973")) != std::string::npos) {
-                std::string message = data.substr(0, end_marker);
-                data.erase(0, end_marker + 9);  // Remove message + marker
+            // Large frames arrive over many reads; only search the new bytes,
+            // and drop the messages handled in this read in one go
+            size_t start = 0, end_marker;
+            while ((end_marker = data.find("END238973", std::max(start, scan_from))) != std::string::npos) {
+                std::string message = data.substr(start, end_marker - start);
+                start = end_marker + 9;  // Skip message + marker
+
+                Expiry expires;
+                if (!message.empty() && message[0] == kDeadlinePrefix) {
+                    size_t pos = 1;
+                    uint64_t ms;
+                    if (!read_varint(message, pos, ms)) {
+                        std::cerr << "Malformed deadline, dropping frame.\n";
+                        frame_done(*client);
+                        continue;
+                    }
+                    expires = Expiry(std::chrono::milliseconds(ms));
+                    message.erase(0, pos);
+                }
+
+                bool compressed = !message.empty() && message[0] == kCompressedPrefix;
+                if (compressed) {
+                    message.erase(0, 1);
+                }
+
+                if (!control && message.compare(0, 5, "GET /") == 0) {
+                    set_priority(client_fd, Priority::Control);
+                    control = true;
+                }
+
+                if (!message.empty() && message[0] >= kInternedFrame && message[0] <= kAckedFrame) {
+                    char frame = message[0];
+                    if (frame == kAckedFrame) {
+                        ++acked_frames; // Counted even if unusable, to keep the acks aligned
+                    }
+
+                    size_t pos = 1;
+                    uint64_t id, seq = 0;
+                    if (!read_varint(message, pos, id) || id >= topic_slots.size() || topic_slots[id].topic.empty() ||
+                        (frame != kInternedFrame && !read_varint(message, pos, seq))) {
+                        std::cerr << "Frame for unbound topic ID, dropping.\n";
+                        frame_done(*client);
+                        continue;
+                    }
+
+                    std::string content = message.substr(pos);
+                    if (compressed && !unpack(content)) {
+                        frame_done(*client);
+                        continue;
+                    }
+
+                    TopicSlot& slot = topic_slots[id];
+                    uint64_t version = subscriptions_.version();
+                    if (slot.version != version) {
+                        slot.callbacks = subscriptions_.resolve(slot.topic);
+                        slot.version = version;
+                    }
+
+                    std::unique_lock<std::mutex> in_order;
+                    if (seq && slot.stream) {
+                        in_order = std::unique_lock<std::mutex>(slot.stream->mutex);
+                    }
+                    bool fresh = !in_order || slot.stream->accept(seq);
+                    if (fresh && config_.last_value_relay && config_.last_value_cache_bytes > 0) {
+                        cache_last_value(slot.topic, content, 0, expires); // As deliver_local() does
+                    }
+                    if (fresh && !slot.callbacks.empty()) {
+                        dispatch(slot.strand, slot.topic, std::move(content), slot.callbacks, client, expires);
+                    } else {
+                        frame_done(*client);
+                    }
+                    if (in_order) in_order.unlock();
 
-                if (message.find("GET /info") == 0) {
+                    if (frame == kInternedFrame) {
+                        std::string response = "HTTP/1.1 200 OK\r\n\r\n";
+                        client->send(response);
+                    }
+                }
+                else if (message.find("GET /digest") == 0) {
+                    std::string response = handle_digest_request(message.substr(message.find("\r\n\r\n") + 4)) + "END238973";
+                    digest_bytes_ += message.size() + response.size();
+                    client->send(response);
+                }
+                else if (message.find("GET /info") == 0) {
                     std::string json_payload = message.substr(message.find("\r\n\r\n") + 4);
+                    bool capabilities = false; // Python nodes read the reply with one recv(1024)
                     try {
                         json remote = json::parse(json_payload);
-                        std::string ip = remote["self"]["IP"];
-                        int port = remote["self"]["port"];
-                        std::vector<std::string> topics = remote["self"]["subscribed_topics"];
-                        add_known_node(ip, port, topics);
+                        capabilities = remote["self"].contains("capabilities");
+                        merge_known_nodes({remote["self"]});
                     } catch (...) {
                         std::cerr << "Failed to parse JSON in GET /info.\n";
                     }
 
-                    std::string response = get_info_json();
-                    send(client_fd, response.c_str(), response.size(), 0);
+                    std::string response = gossip_info(true, capabilities).dump();
+                    full_gossip_bytes_ += message.size() + response.size();
+                    client->send(response);
+                }
+                else if (message.find("GET /last/") == 0) {
+                    // The body is the requester's membership record, so we can reach it
+                    try {
+                        auto end = message.find(" HTTP", 10);
+                        std::string pattern = message.substr(10, end - 10);
+                        json requester = json::parse(message.substr(message.find("\r\n\r\n") + 4));
+                        merge_known_nodes({requester});
+                        last_value_requests_.push({{requester["IP"], requester["port"]}, pattern});
+                        wake_sender();
+                    } catch (...) {
+                        std::cerr << "Failed to parse GET /last request.\n";
+                    }
+                }
+                else if (message.find("GET /topics") == 0) {
+                    auto m = membership_.read();
+                    std::string response = json{{"subscribed_topics", m->self.topics},
+                                                {"topics_version", m->self.topics_version}}.dump() + "END238973";
+                    client->send(response);
                 }
                 else if (message.find("POST /") == 0) {
+                    bool replies = true; // Sequenced POSTs get no status line
                     try {
                         auto start = message.find("POST /") + 6;
                         auto end = message.find(" HTTP", start);
@@ -112,185 +556,2341 @@ void GossipNode::handle_client(int client_fd) {
                         auto split_pos = path.find('/');
                         std::string topic = path.substr(split_pos + 1);
 
-                        std::string body = message.substr(message.find("\r\n\r\n") + 4);
+                        auto header_end = message.find("\r\n\r\n");
+                        std::string headers = message.substr(0, header_end + 2);
+                        std::string body = message.substr(header_end + 4);
+                        if (header_value(headers, "Content-Encoding") == "lz" && !unpack(body)) {
+                            throw std::runtime_error("malformed compressed body");
+                        }
+
+                        std::shared_ptr<InboundStream> stream;
+                        std::string publisher = header_value(headers, "Publisher-Session");
+                        std::string seq = header_value(headers, "Seq");
+                        if (!publisher.empty() && !seq.empty()) {
+                            stream = inbound_stream(publisher, topic);
+                        }
+                        replies = seq.empty();
+                        if (header_value(headers, "Ack") == "1") {
+                            ++acked_frames;
+                        }
+                        if (header_value(headers, "Credit") == "1" && !client->credits.exchange(true)) {
+                            frame_done(*client, 0); // First grant
+                        }
+
+                        // Topic-Id binds the topic (and stream) for later interned frames.
+                        // Peers number topics densely from 0, so an ID past the end is not
+                        // one of ours to allocate for
+                        std::string topic_id = header_value(headers, "Topic-Id");
+                        if (!topic_id.empty()) {
+                            size_t id = std::stoul(topic_id);
+                            if (id > topic_slots.size() || id >= kMaxTopicIds) {
+                                std::cerr << "Topic-Id " << topic_id << " out of range, closing connection.\n";
+                                misbehaving = true;
+                                break;
+                            }
+                            if (id == topic_slots.size()) topic_slots.emplace_back();
+                            topic_slots[id] = TopicSlot{topic, {}, ~0ULL, stream,
+                                                        dispatch_ ? dispatch_->strand(topic) : nullptr};
+                        }
 
-                        if (subscriptions_.count(topic)) {
-                            for (auto& cb : subscriptions_[topic]) {
-                                cb(topic, body);
+                        if (stream && seq != "0") { // 0: a message the publisher did not number
+                            // A gap on a POST follows a reconnect; the publisher
+                            // says whether it kept history to fill it from
+                            std::pair<uint64_t, uint64_t> resend{0, 0};
+                            {
+                                std::lock_guard<std::mutex> in_order(stream->mutex);
+                                if (stream->accept(std::stoull(seq),
+                                                   header_value(headers, "History") == "1" ? &resend : nullptr)) {
+                                    deliver_local(topic, body, client, expires);
+                                } else {
+                                    frame_done(*client);
+                                }
+                            }
+                            if (resend.first) {
+                                client->send("RESEND " + std::to_string(resend.first) + " " +
+                                             std::to_string(resend.second) + " " + topic + "\r\n\r\n");
                             }
+                        } else {
+                            deliver_local(topic, body, client, expires);
                         }
 
-                        std::string response = "HTTP/1.1 200 OK\r\n\r\n";
-                        send(client_fd, response.c_str(), response.size(), 0);
+                        if (replies) {
+                            std::string response = "HTTP/1.1 200 OK\r\n\r\n";
+                            client->send(response);
+                        }
                     } catch (...) {
                         std::cerr << "Error parsing POST message\n";
-                        std::string response = "HTTP/1.1 400 Bad Request\r\n\r\n";
-                        send(client_fd, response.c_str(), response.size(), 0);
+                        frame_done(*client); // Thrown before delivery
+                        if (replies) {
+                            std::string response = "HTTP/1.1 400 Bad Request\r\n\r\n";
+                            client->send(response);
+                        }
                     }
                 }
                 else {
                     std::string response = "HTTP/1.1 400 Bad Request\r\n\r\n";
-                    send(client_fd, response.c_str(), response.size(), 0);
+                    client->send(response);
                 }
             }
+            if (misbehaving) break;
+
+            data.erase(0, start);
+            scan_from = data.size() > 8 ? data.size() - 8 : 0;
+
+            // One cumulative ack covers every acked frame in this read
+            if (acked_frames != acks_sent) {
+                std::string ack = "ACK " + std::to_string(acked_frames) + "\r\n\r\n";
+                client->send(ack);
+                acks_sent = acked_frames;
+            }
         }
     } catch (...) {
         std::cerr << "Error in client handler.\n";
     }
 
-    close(client_fd); // Close once disconnected
+    // Last use of the node: once the set is empty it may be destroyed. The
+    // socket closes once callbacks still queued for it have run.
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    client_fds_.erase(client_fd);
+    clients_cv_.notify_all();
 }
 
-void GossipNode::add_known_node(const std::string& ip, int port, const std::vector<std::string>& topics) {
-    for (auto& node : info_["known_nodes"]) {
-        if (node["IP"] == ip && node["port"] == port) {
-            for (const auto& topic : topics) {
-                if (std::find(node["subscribed_topics"].begin(), node["subscribed_topics"].end(), topic) == node["subscribed_topics"].end()) {
-                    node["subscribed_topics"].push_back(topic);
-                }
-            }
-            return;
+void GossipNode::InboundConnection::send(const std::string& data) {
+    std::lock_guard<std::mutex> lock(send_mutex);
+    ::send(fd, data.c_str(), data.size(), 0);
+}
+
+GossipNode::InboundConnection::~InboundConnection() {
+    close(fd);
+}
+
+// Grants are cumulative ("CREDIT n": the peer may send n data frames in
+// total) and go out once a quarter of the window has been consumed, so
+// credits cost one small reply per window/4 messages.
+void GossipNode::frame_done(InboundConnection& client, uint64_t frames) {
+    uint64_t done = client.completed += frames;
+    if (!client.credits) return;
+
+    uint64_t window = std::max<uint64_t>(kInitialCredits, config_.credit_window);
+    std::lock_guard<std::mutex> lock(client.send_mutex);
+    done = client.completed;
+    if (client.granted && done + window < client.granted + window / 4) return;
+    client.granted = done + window;
+    std::string grant = "CREDIT " + std::to_string(client.granted) + "\r\n\r\n";
+    ::send(client.fd, grant.c_str(), grant.size(), 0);
+    ++credit_grants_;
+}
+
+// Sequence numbers are counted from the first message received on a stream,
+// so joining a running stream does not count as loss. A message resent from
+// history arrives behind newer ones and is accepted once, if it was missing.
+bool GossipNode::InboundStream::accept(uint64_t seq, std::pair<uint64_t, uint64_t>* resend) {
+    uint64_t last = last_seq;
+    if (delivered == 0 && stale == 0) {
+        last = seq - 1;
+    }
+    if (seq <= last) {
+        if (missing.erase(seq)) {
+            --lost;
+            ++recovered;
+            ++delivered;
+            return true;
+        }
+        ++stale;
+        return false;
+    }
+    if (resend && seq > last + 1) {
+        uint64_t from = std::max(last + 1, seq > kMaxMissing ? seq - kMaxMissing : 1);
+        for (uint64_t missed = from; missed < seq; ++missed) {
+            missing.insert(missing.end(), missed);
+        }
+        while (missing.size() > kMaxMissing) {
+            missing.erase(missing.begin());
+        }
+        *resend = {from, seq - 1};
+    }
+    lost += seq - last - 1;
+    last_seq = seq;
+    ++delivered;
+    return true;
+}
+
+std::shared_ptr<GossipNode::InboundStream> GossipNode::inbound_stream(const std::string& publisher, const std::string& topic) {
+    std::lock_guard<std::mutex> lock(streams_mutex_);
+    auto& stream = inbound_streams_[{publisher, topic}];
+    if (!stream) {
+        stream = std::make_shared<InboundStream>();
+        stream->publisher = publisher;
+        stream->topic = topic;
+    }
+    return stream;
+}
+
+bool GossipNode::PeerRecord::add_topic(const std::string& topic) {
+    if (std::find(topics.begin(), topics.end(), topic) != topics.end()) {
+        return false;
+    }
+    topics.push_back(topic);
+    if (TopicTrie<int>::is_pattern(topic)) {
+        patterns.push_back(topic);
+        pattern_trie[topic] = true;
+    } else {
+        exact.insert(topic);
+    }
+    return true;
+}
+
+bool GossipNode::PeerRecord::remove_topic(const std::string& topic) {
+    auto it = std::find(topics.begin(), topics.end(), topic);
+    if (it == topics.end()) {
+        return false;
+    }
+    topics.erase(it);
+    patterns.erase(std::remove(patterns.begin(), patterns.end(), topic), patterns.end());
+    pattern_trie.erase(topic);
+    exact.erase(topic);
+    return true;
+}
+
+void GossipNode::PeerRecord::clear_topics() {
+    while (!topics.empty()) {
+        remove_topic(topics.back());
+    }
+    filter = TopicFilter();
+    exact_fetched = false;
+}
+
+bool GossipNode::PeerRecord::has_capability(const std::string& capability) const {
+    return std::find(capabilities.begin(), capabilities.end(), capability) != capabilities.end();
+}
+
+GossipNode::PeerRecord* GossipNode::Membership::find(const std::string& ip, int port) {
+    for (auto& node : known_nodes) {
+        if (node.ip == ip && node.port == port) {
+            return &node;
         }
     }
+    return nullptr;
+}
 
-    json node = {
+void GossipNode::add_known_node(const std::string& ip, int port, const std::vector<std::string>& topics) {
+    merge_known_nodes({json{
         {"IP", ip},
         {"port", port},
         {"subscribed_topics", topics}
-    };
-    info_["known_nodes"].push_back(node);
+    }});
 }
 
 void GossipNode::add_known_node(const std::string& ip, int port) {
     add_known_node(ip, port, {});
 }
 
-void GossipNode::publish(const std::string& topic, const std::string& content) {
-    for (const auto& node : info_["known_nodes"]) {
-        const std::string ip = node["IP"];
-        int port = node["port"];
-        std::string path = ip + ":" + std::to_string(port) + "/" + topic;
-        std::string message = "POST /" + path + " HTTP/1.1\r\nContent-Type: text/plain\r\n\r\n" + content + "END238973";
+// Merges gossiped peer records, including topic filters and capabilities, in
+// one membership update. Records that change nothing publish no new snapshot.
+void GossipNode::merge_known_nodes(const std::vector<json>& records) {
+    bool changed = membership_.update([&](Membership& m) {
+        bool changed = false;
+        for (const auto& record : records) {
+            std::string ip = record["IP"];
+            int port = record["port"];
+            if (ip == host_ && port == port_) {
+                continue; // Our own record lives in self
+            }
 
-        std::pair<std::string, int> key = {ip, port};
-        int sock;
-        bool socket_is_valid = true;
+            PeerRecord* node = m.find(ip, port);
+            if (!node) {
+                m.known_nodes.emplace_back();
+                node = &m.known_nodes.back();
+                node->ip = ip;
+                node->port = port;
+                changed = true;
+            }
 
-        {
-            std::lock_guard<std::mutex> lock(conn_mutex_);
-            if (socket_pool_.count(key)) {
-                sock = socket_pool_[key];
-            } else {
-                sock = socket(AF_INET, SOCK_STREAM, 0);
-                if (sock < 0) {
-                    std::cerr << "Socket creation failed.\n";
-                    continue;
+            // A newer list replaces the old one, so unsubscribes reach us; an
+            // older one is stale news. Unversioned records only ever add.
+            uint64_t version = record.value("topics_version", uint64_t(0));
+            bool stale = version && version < node->topics_version;
+            if (version > node->topics_version) {
+                node->clear_topics();
+                node->topics_version = version;
+                changed = true;
+            }
+            if (record.contains("subscribed_topics") && !stale) {
+                for (std::string topic : record["subscribed_topics"]) {
+                    changed |= node->add_topic(topic);
                 }
-
-                sockaddr_in addr{};
-                addr.sin_family = AF_INET;
-                addr.sin_port = htons(port);
-                inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
-
-                if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
-                    //std::cerr << "Connection failed to " << ip << ":" << port << "\n";
-                    close(sock);
-                    continue;
+            }
+            if (record.contains("capabilities")) {
+                std::vector<std::string> capabilities = record["capabilities"];
+                if (capabilities != node->capabilities) {
+                    node->capabilities = capabilities;
+                    changed = true;
                 }
-
-                socket_pool_[key] = sock;
+            }
+            if (record.contains("topic_filter") && !stale && node->filter.merge(TopicFilter(record["topic_filter"]))) {
+                node->exact_fetched = false; // Peer subscribed to something new
+                changed = true;
             }
         }
+        return changed;
+    });
+    if (changed) membership_changed();
+}
 
-        try {
-            ssize_t sent = send(sock, message.c_str(), message.size(), 0);
-            if (sent != (ssize_t)message.size()) {
-                throw std::runtime_error("Partial or failed send");
-            }
-        } catch (...) {
-            std::cerr << "Send error to " << ip << ":" << port << ", cleaning up.\n";
-            std::lock_guard<std::mutex> lock(conn_mutex_);
-            close(sock);
-            socket_pool_.erase(key);
-            continue; // Don't crash — just skip this node
+json GossipNode::record_json(const PeerRecord& node) {
+    json record = {
+        {"IP", node.ip},
+        {"port", node.port},
+        {"subscribed_topics", node.topics}
+    };
+    if (!node.capabilities.empty()) {
+        record["capabilities"] = node.capabilities;
+    }
+    if (node.topics_version) {
+        record["topics_version"] = node.topics_version;
+    }
+    return record;
+}
+
+json GossipNode::gossip_info(bool count_savings, bool capabilities) {
+    auto m = membership_.read();
+    json info;
+    info["self"] = record_json(m->self);
+
+    if (config_.topic_summary) {
+        // Only exact topics go into the filter; wildcard patterns stay listed
+        std::vector<std::string> exact(m->self.exact.begin(), m->self.exact.end());
+        json summary = TopicFilter(exact).to_json();
+        size_t list_bytes = json(exact).dump().size();
+        size_t summary_bytes = summary.dump().size();
+        if (summary_bytes < list_bytes) {
+            info["self"]["subscribed_topics"] = m->self.patterns;
+            info["self"]["topic_filter"] = summary;
+            if (count_savings) summary_bytes_saved_ += list_bytes - summary_bytes;
         }
     }
 
-    // Local delivery if subscribed
-    if (subscriptions_.count(topic)) {
-        for (auto& cb : subscriptions_[topic]) {
-            cb(topic, content);
+    // Forward summaries as we got them, never the lazily fetched exact lists
+    info["known_nodes"] = json::array();
+    for (const auto& node : m->known_nodes) {
+        json record = record_json(node);
+        if (!node.filter.empty()) {
+            record["subscribed_topics"] = node.patterns;
+            record["topic_filter"] = node.filter.to_json();
+        }
+        info["known_nodes"].push_back(record);
+    }
+    if (!capabilities) {
+        info["self"].erase("capabilities");
+        for (auto& record : info["known_nodes"]) {
+            record.erase("capabilities");
         }
     }
+    return info;
 }
 
+bool GossipNode::node_wants_topic(const PeerRecord& node, const std::string& topic) {
+    if (node.exact.count(topic)) {
+        return true;
+    }
+    bool matched = false;
+    node.pattern_trie.match(topic, [&](bool) { matched = true; });
+    if (matched) {
+        return true;
+    }
 
-void GossipNode::subscribe(const std::string& topic, std::function<void(const std::string&, const std::string&)> callback) {
-    subscriptions_[topic].push_back(callback);
-    if (std::find(info_["self"]["subscribed_topics"].begin(), info_["self"]["subscribed_topics"].end(), topic) == info_["self"]["subscribed_topics"].end()) {
-        info_["self"]["subscribed_topics"].push_back(topic);
+    if (node.filter.empty() || !node.filter.might_contain(topic)) {
+        return false;
     }
-}
 
-void GossipNode::update_known_nodes_periodically() {
-    while (true) {
-        {
-            std::lock_guard<std::mutex> lock(conn_mutex_);
-            if (!info_["known_nodes"].empty()) {
-                size_t i = rand() % info_["known_nodes"].size();
-                auto node = info_["known_nodes"][i];
-                std::string ip = node["IP"];
-                int port = node["port"];
-                query_node_for_info(ip, port);
-            }
-        }
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+    ++summary_filter_matches_;
+    if (node.exact_fetched) {
+        ++summary_false_positives_; // Exact list is current and says no
+        return false;
     }
+    // Deliver on the filter until the gossip thread has fetched the exact list
+    std::lock_guard<std::mutex> lock(summary_mutex_);
+    pending_topic_fetches_.insert({node.ip, node.port});
+    return true;
 }
-void GossipNode::query_node_for_info(const std::string& ip, int port) {
+
+void GossipNode::fetch_exact_topics(const std::string& ip, int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return;
+    set_priority(sock, Priority::Control);
+
     try {
-        int sock = socket(AF_INET, SOCK_STREAM, 0);
-        if (sock < 0) return;
+        timeval timeout{2, 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 
         sockaddr_in addr{};
         addr.sin_family = AF_INET;
         addr.sin_port = htons(port);
         inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
 
-        if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
-            close(sock);
-            return;
+        std::string response;
+        if (connect(sock, (sockaddr*)&addr, sizeof(addr)) == 0 &&
+            exchange(sock, "GET /topics\r\n\r\nEND238973", response)) {
+            json reply = json::parse(response);
+            std::vector<std::string> topics = reply["subscribed_topics"];
+            uint64_t version = reply.value("topics_version", uint64_t(0));
+            bool changed = membership_.update([&](Membership& m) {
+                PeerRecord* node = m.find(ip, port);
+                // A list older than what gossip brought since is stale; the
+                // next filter match fetches again
+                if (!node || (version && version < node->topics_version)) return false;
+                if (version > node->topics_version) {
+                    node->clear_topics();
+                    node->topics_version = version;
+                }
+                for (const auto& topic : topics) {
+                    node->add_topic(topic);
+                }
+                node->exact_fetched = true;
+                return true;
+            });
+            if (changed) membership_changed();
+            ++summary_topic_fetches_;
         }
+    } catch (...) {
+        // Retried the next time the filter matches
+    }
+    close(sock);
+}
 
-        std::string body = info_.dump();
-        std::string request = "GET /info\r\n\r\n" + body + "END238973";
-        send(sock, request.c_str(), request.size(), 0);
+void GossipNode::publish(const std::string& topic, const std::string& content) {
+    send_to_peers(topic, content, nullptr, {});
+}
 
-        char buffer[4096];
-        ssize_t bytes = recv(sock, buffer, sizeof(buffer), 0);
-        if (bytes > 0) {
-            std::string response(buffer, bytes);
-            auto json_start = response.find("{");
-            if (json_start != std::string::npos) {
-                std::string json_body = response.substr(json_start);
-                json remote_info = json::parse(json_body);
+void GossipNode::publish(const std::string& topic, const std::string& content, std::chrono::milliseconds ttl) {
+    publish_until(topic, content, std::chrono::system_clock::now() + ttl);
+}
 
-                auto remote_self = remote_info["self"];
-                add_known_node(remote_self["IP"], remote_self["port"], remote_self["subscribed_topics"]);
+void GossipNode::publish_until(const std::string& topic, const std::string& content,
+                               std::chrono::system_clock::time_point deadline) {
+    send_to_peers(topic, content, nullptr, {}, nullptr, 0, deadline);
+}
 
-                for (const auto& node : remote_info["known_nodes"]) {
-                    add_known_node(node["IP"], node["port"], node["subscribed_topics"]);
-                }
-            }
+std::future<bool> GossipNode::publish_acked(const std::string& topic, const std::string& content,
+                                            std::chrono::milliseconds timeout) {
+    auto promise = std::make_shared<std::promise<bool>>();
+    auto future = promise->get_future();
+    publish_acked(topic, content, timeout, [promise](bool delivered) {
+        promise->set_value(delivered);
+    });
+    return future;
+}
+
+void GossipNode::publish_acked(const std::string& topic, const std::string& content,
+                               std::chrono::milliseconds timeout, std::function<void(bool)> done) {
+    auto ack = std::make_shared<PendingAck>();
+    ack->done = std::move(done);
+    ack->node = this;
+    engine_->post([this, ack, timeout] {
+        if (ack->finished) return;
+        uint64_t timer = engine_->run_after(timeout, [ack] {
+            ack->timer = 0; // Nothing left to cancel
+            ack->complete(false);
+        });
+        if (ack->timer.exchange(timer) == PendingAck::kTimerDone) {
+            engine_->cancel(timer); // Completed while the timer was being set
         }
+    });
+    send_to_peers(topic, content, ack, std::chrono::steady_clock::now() + timeout);
+    ack->release(); // Every send is issued
+}
 
-        close(sock);
-    } catch (...) {
-        // Silently fail, optional logging
+void GossipNode::publish_queued(std::string topic, std::string content) {
+    size_t lane = lane_of(topic_priority(topic));
+    ingress_[lane].push({std::move(topic), std::move(content)});
+    wake_sender();
+}
+
+void GossipNode::publish_queued(PublishBatch&& batch) {
+    ingress_[lane_of(Priority::Normal)].push(std::move(batch.chain_));
+    wake_sender();
+}
+
+void GossipNode::uncork(CorkedConnections& corked) {
+    int off = 0;
+    for (auto& conn : corked) {
+        setsockopt(conn->fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
     }
+    corked.clear();
 }
 
+// Producers pay for the mutex and the notify only while the sender sleeps.
+// Both sides use sequentially consistent operations: either the producer sees
+// sender_sleeping_ or the sender sees the new message before it waits.
+void GossipNode::wake_sender() {
+    if (sender_sleeping_.load()) {
+        {
+            std::lock_guard<std::mutex> lock(sender_mutex_);
+        }
+        sender_cv_.notify_one();
+    }
+}
 
-std::string GossipNode::get_info_json() const {
-    return info_.dump(4);
+void GossipNode::drain_ingress() {
+    CorkedConnections corked;
+    std::shared_ptr<Connection> conn;
+    while (running_) {
+        while (flush_requests_.pop(conn)) {
+            std::unique_lock<std::mutex> lock(conn->send_mutex);
+            if (conn->closed || conn->held.empty()) continue;
+            try {
+                flush_held(*conn);
+            } catch (...) {
+                std::cerr << "Send error to " << conn->key.first << ":" << conn->key.second << ", cleaning up.\n";
+                lock.unlock();
+                drop_connection(conn);
+            }
+        }
+        conn.reset();
+        ParkKey parked;
+        while (unparked_.pop(parked)) {
+            unpark(parked);
+        }
+        if (last_values_dirty_.exchange(false)) {
+            push_last_values();
+        }
+        std::pair<PeerKey, std::string> request;
+        while (last_value_requests_.pop(request)) {
+            serve_last_values(request.first, request.second);
+        }
+        ResendRequest resend;
+        while (resend_requests_.pop(resend)) {
+            serve_resend(resend);
+        }
+        std::pair<std::string, uint64_t> due;
+        while (series_due_.pop(due)) {
+            send_series(due.first, due.second);
+        }
+
+        uint64_t drained = drain_lanes(kDataLanes, &corked);
+        uncork(corked);
+        ingress_sent_ += drained;
+        if (drained > ingress_largest_drain_) {
+            ingress_largest_drain_ = drained;
+        }
+
+        std::unique_lock<std::mutex> lock(sender_mutex_);
+        sender_sleeping_ = true;
+        sender_cv_.wait(lock, [this] {
+            return !running_ || has_ingress(kDataLanes) || !flush_requests_.empty() || !unparked_.empty() ||
+                   last_values_dirty_ || !last_value_requests_.empty() || !resend_requests_.empty() ||
+                   !series_due_.empty();
+        });
+        sender_sleeping_ = false;
+        ++ingress_wakeups_;
+    }
+}
+
+bool GossipNode::has_ingress(size_t lanes) {
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        if (!ingress_[lane].empty()) return true;
+    }
+    return false;
+}
+
+// Always takes the next message from the highest lane that has one. A frame
+// from a lower lane lets the higher lanes go first between its chunks; those
+// sends are not corked, so they leave right away.
+uint64_t GossipNode::drain_lanes(size_t lanes, CorkedConnections* corked) {
+    std::pair<std::string, std::string> message;
+    uint64_t drained = 0;
+    while (true) {
+        size_t lane = 0;
+        while (lane < lanes && !ingress_[lane].pop(message)) ++lane;
+        if (lane == lanes) break;
+
+        // A lone message goes out right away, uncorked
+        bool batch = corked && (!corked->empty() || has_ingress(lanes));
+        send_to_peers(message.first, message.second, nullptr, {}, batch ? corked : nullptr, lane);
+        if (corked && (++drained % 64 == 0 || !has_ingress(lanes))) {
+            uncork(*corked);
+        }
+    }
+    return drained;
+}
+
+void GossipNode::PatternIndex::add(const std::string& pattern, size_t position) {
+    size_t before = trie.size();
+    size_t& slot = trie[pattern];
+    if (trie.size() != before) {
+        slot = position; // A repeated pattern keeps its first position
+    }
+}
+
+size_t GossipNode::PatternIndex::first_match(const std::string& topic) const {
+    size_t first = npos;
+    if (!trie.empty()) {
+        trie.match(topic, [&](size_t position) { first = std::min(first, position); });
+    }
+    return first;
+}
+
+void GossipNode::index_patterns() {
+    for (size_t i = 0; i < config_.topic_priorities.size(); ++i) {
+        priority_patterns_.add(config_.topic_priorities[i].first, i);
+    }
+    for (size_t i = 0; i < config_.flow_policies.size(); ++i) {
+        flow_patterns_.add(config_.flow_policies[i].first, i);
+    }
+    for (size_t i = 0; i < config_.topic_rate_limits.size(); ++i) {
+        rate_patterns_.add(config_.topic_rate_limits[i].first, i);
+    }
+    for (size_t i = 0; i < config_.conflated_topics.size(); ++i) {
+        conflated_patterns_.add(config_.conflated_topics[i], i);
+    }
+    for (size_t i = 0; i < config_.compressed_topics.size(); ++i) {
+        compressed_patterns_.add(config_.compressed_topics[i], i);
+    }
+    for (size_t i = 0; i < config_.logged_topics.size(); ++i) {
+        logged_patterns_.add(config_.logged_topics[i], i);
+    }
+}
+
+Priority GossipNode::topic_priority(const std::string& topic) const {
+    size_t match = priority_patterns_.first_match(topic);
+    if (match == PatternIndex::npos) return Priority::Normal;
+    Priority priority = config_.topic_priorities[match].second;
+    return priority == Priority::Control ? Priority::High : priority;
+}
+
+size_t GossipNode::lane_of(Priority priority) {
+    return std::min<size_t>(kDataLanes - 1, std::max(0, int(priority) - int(Priority::High)));
+}
+
+void GossipNode::PendingAck::complete(bool delivered) {
+    if (finished.exchange(true)) return;
+    uint64_t id = timer.exchange(kTimerDone);
+    if (id != 0 && node) {
+        node->cancel_timer(id);
+    }
+    if (done) {
+        done(delivered);
+    }
+}
+
+// Safe from any thread; a no-op once the engine is gone at shutdown
+void GossipNode::cancel_timer(uint64_t timer_id) {
+    if (!engine_) return;
+    if (engine_->in_engine_thread()) {
+        engine_->cancel(timer_id);
+    } else {
+        engine_->post([this, timer_id] { engine_->cancel(timer_id); });
+    }
+}
+
+void GossipNode::PendingAck::release() {
+    if (--remaining == 0) {
+        complete(true);
+    }
+}
+
+GossipNode::Connection::~Connection() {
+    close(fd);
+}
+
+// Without ack, a fire-and-forget publish: peers with the "acks" capability
+// send nothing back for it.
+void GossipNode::send_to_peers(const std::string& topic, const std::string& content,
+                               const std::shared_ptr<PendingAck>& ack, std::chrono::steady_clock::time_point deadline,
+                               CorkedConnections* corked, size_t preempt_below, Expiry expires) {
+    if (expired(expires)) {
+        count_expired(topic, kExpiredSending);
+        if (ack) ack->complete(false);
+        return;
+    }
+    auto started = std::chrono::steady_clock::now();
+    if (!config_.topic_log_dir.empty()) {
+        if (auto log = topic_log(topic)) {
+            log_appends_.push({std::move(log), content, std::chrono::system_clock::now()});
+            if (log_sleeping_.load()) {
+                { std::lock_guard<std::mutex> lock(log_mutex_); }
+                log_cv_.notify_one();
+            }
+        }
+    }
+    OutboundMessage message{topic, content, 0, ack, {}, {}, expires, {}};
+    if (admit(message, nullptr)) {
+        message.seq = next_seq(topic, content, expires);
+        send_remote(message, deadline, corked, preempt_below);
+    }
+
+    publish_latency_.record(std::chrono::steady_clock::now() - started);
+
+    // Local delivery if subscribed
+    deliver_local(topic, content);
+}
+
+uint64_t GossipNode::next_seq(const std::string& topic, const std::string& content, Expiry expires) {
+    bool keep = config_.history_depth > 0 && content.size() <= config_.history_message_limit;
+    uint64_t seq;
+    {
+        std::lock_guard<std::mutex> lock(publish_seqs_mutex_);
+        PublishStream& stream = publish_seqs_[topic];
+        seq = ++stream.seq;
+        if (keep) {
+            if (!stream.history) stream.history = std::make_unique<TopicHistory>(config_.history_depth);
+            stream.history->put(seq, content, expires);
+        }
+    }
+    if (config_.last_value_cache_bytes > 0) {
+        cache_last_value(topic, content, seq, expires);
+    }
+    return seq;
+}
+
+void GossipNode::send_remote(const OutboundMessage& outbound, std::chrono::steady_clock::time_point deadline,
+                             CorkedConnections* corked, size_t preempt_below,
+                             const std::pair<std::string, int>* only, bool admitted) {
+    const std::string& topic = outbound.topic;
+    const auto& ack = outbound.ack;
+    Priority lane = topic_priority(topic);
+    uint64_t seq = outbound.seq;
+    // Compressed once, for the first peer that can take it
+    bool compress = !config_.compressed_topics.empty() && is_compressed(topic);
+    std::shared_ptr<const std::string> packed;
+    int conflates = -1;  // Looked up for the first peer with credits
+    auto members = membership_.read();
+    for (const auto& node : members->known_nodes) {
+        if (only ? node.ip != only->first || node.port != only->second : !node_wants_topic(node, topic)) {
+            continue;
+        }
+        if (compress && node.has_capability("lz")) {
+            packed = pack(outbound.content);
+            compress = false;
+        }
+
+        const std::string& ip = node.ip;
+        int port = node.port;
+        PoolKey key = {{ip, port}, lane};
+        OutboundMessage message{topic, outbound.content, seq, ack, {}, {}, outbound.expires, packed};
+        if (rate_limited_ && !admitted) {
+            // A peer whose limit conflates can miss any number, so it gets
+            // none: its copies leave the park by key, not by number
+            if (peer_conflates(key.first)) message.seq = 0;
+            if (!admit(message, &key.first)) continue;
+        }
+        std::shared_ptr<Connection> conn;
+
+        {
+            std::lock_guard<std::mutex> lock(conn_mutex_);
+            if (socket_pool_.count(key)) {
+                conn = socket_pool_[key];
+            } else {
+                int sock = socket(AF_INET, SOCK_STREAM, 0);
+                if (sock < 0) {
+                    std::cerr << "Socket creation failed.\n";
+                    if (ack) ack->complete(false);
+                    continue;
+                }
+
+                sockaddr_in addr{};
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons(port);
+                inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+
+                if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+                    //std::cerr << "Connection failed to " << ip << ":" << port << "\n";
+                    close(sock);
+                    if (ack) ack->complete(false);
+                    continue;
+                }
+
+                set_priority(sock, lane);
+                conn = std::make_shared<Connection>();
+                conn->fd = sock;
+                conn->key = key.first;
+                conn->lane = lane;
+                socket_pool_[key] = conn;
+                watch_connection(conn);
+            }
+        }
+
+        try {
+            std::unique_lock<std::mutex> send_lock(conn->send_mutex);
+            conn->sequenced = node.has_capability("seq");
+            conn->peer_acks = node.has_capability("acks");
+            conn->interning = node.has_capability("topic_ids");
+            conn->credits = node.has_capability("credits");
+            conn->deadlines = node.has_capability("deadlines");
+            conn->compression = node.has_capability("lz");
+
+            // A held copy may be replaced by a newer one, so conflated
+            // topics go out unsequenced wherever credits can hold them
+            if (conn->credits && message.seq) {
+                if (conflates < 0) conflates = flow_policy(topic) == FlowPolicy::Conflate;
+                if (conflates) message.seq = 0;
+            }
+            if (conn->credits && (!conn->held.empty() || conn->frames_sent >= conn->credit_limit)) {
+                hold(*conn, std::move(message), send_lock);
+                continue;
+            }
+            // Batch senders cork each connection once and uncork when done,
+            // so the frames of a batch leave in as few segments as possible
+            if (corked && std::find(corked->begin(), corked->end(), conn) == corked->end()) {
+                int on = 1;
+                setsockopt(conn->fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+                corked->push_back(conn);
+            }
+            if (!send_frame(*conn, message, deadline, preempt_below) && ack) {
+                ack->complete(false);
+            }
+        } catch (...) {
+            std::cerr << "Send error to " << ip << ":" << port << ", cleaning up.\n";
+            drop_connection(conn);
+            continue; // Don't crash — just skip this node
+        }
+    }
+}
+
+const RateLimit& GossipNode::peer_rate_limit(const std::pair<std::string, int>& peer) const {
+    if (!config_.peer_rate_limits.empty()) {
+        auto named = config_.peer_rate_limits.find(peer.first + ":" + std::to_string(peer.second));
+        if (named != config_.peer_rate_limits.end()) return named->second;
+    }
+    return config_.peer_rate_limit;
+}
+
+bool GossipNode::peer_conflates(const std::pair<std::string, int>& peer) const {
+    const RateLimit& limit = peer_rate_limit(peer);
+    return limit.policy == FlowPolicy::Conflate && (limit.messages_per_second > 0 || limit.bytes_per_second > 0);
+}
+
+std::vector<GossipNode::RateBudget> GossipNode::rate_budgets(const std::string& topic,
+                                                             const std::pair<std::string, int>* peer) {
+    std::vector<RateBudget> budgets;
+    if (!rate_limited_) return budgets;
+    auto limited = [](const RateLimit& limit) {
+        return limit.messages_per_second > 0 || limit.bytes_per_second > 0;
+    };
+    auto limiter_for = [](std::unique_ptr<RateLimiter>& limiter, const RateLimit& limit) {
+        if (!limiter) {
+            limiter = std::make_unique<RateLimiter>(limit.messages_per_second, limit.bytes_per_second,
+                                                    limit.burst_seconds);
+        }
+        return limiter.get();
+    };
+
+    std::lock_guard<std::mutex> lock(rate_mutex_);
+    if (peer) {
+        const RateLimit* limit = &peer_rate_limit(*peer);
+        if (limited(*limit)) {
+            budgets.push_back({limiter_for(peer_limiters_[*peer], *limit), limit, kPeerRate});
+        }
+        return budgets;
+    }
+    if (node_limiter_) {
+        budgets.push_back({node_limiter_.get(), &config_.node_rate_limit, kNodeRate});
+    }
+    size_t match = rate_patterns_.first_match(topic);
+    if (match != PatternIndex::npos) {
+        const RateLimit& limit = config_.topic_rate_limits[match].second;
+        if (limited(limit)) {
+            budgets.push_back({limiter_for(topic_limiters_[topic], limit), &limit, kTopicRate});
+        }
+    }
+    return budgets;
+}
+
+// The longest wait among the buckets, and the budget it comes from
+std::pair<std::chrono::nanoseconds, const GossipNode::RateBudget*> GossipNode::rate_wait(
+    const std::vector<RateBudget>& budgets, size_t bytes) {
+    std::pair<std::chrono::nanoseconds, const RateBudget*> longest{std::chrono::nanoseconds::zero(), nullptr};
+    for (const auto& budget : budgets) {
+        auto wait = budget.limiter->wait(bytes);
+        if (wait > longest.first) {
+            longest = {wait, &budget};
+        }
+    }
+    return longest;
+}
+
+bool GossipNode::admit(const OutboundMessage& message, const std::pair<std::string, int>* peer) {
+    auto budgets = rate_budgets(message.topic, peer);
+    if (budgets.empty()) return true;
+
+    size_t bytes = message.content.size();
+    auto [wait, binding] = rate_wait(budgets, bytes);
+    std::pair<std::string, int> scope = peer ? *peer : std::pair<std::string, int>{};
+    if (parked_messages_ > 0 && !message.ack) {
+        std::string key = conflation_key(message.topic, message.content);
+        std::lock_guard<std::mutex> lock(rate_mutex_);
+        auto ahead = parked_.lower_bound(ParkKey{scope, message.topic, {}});
+        if (ahead != parked_.end() && std::get<0>(ahead->first) == scope &&
+            std::get<1>(ahead->first) == message.topic) {
+            // Sending now would overtake what is parked; the tokens go to it
+            if (wait.count() > 0) ++rate_counters_[binding->scope].limited;
+            FlowPolicy policy = wait.count() > 0 ? binding->limit->policy : ahead->second.policy;
+            if (policy != FlowPolicy::Drop) {
+                park(ParkKey{scope, message.topic, policy == FlowPolicy::Conflate ? key : std::string()}, message,
+                     policy, wait.count() > 0 ? binding->scope : ahead->second.scope, wait);
+                return false;
+            }
+        }
+    }
+    if (wait.count() > 0) {
+        RateCounters& counters = rate_counters_[binding->scope];
+        ++counters.limited;
+        FlowPolicy policy = binding->limit->policy;
+        if (policy == FlowPolicy::Drop) {
+            ++counters.dropped;
+            if (message.ack) message.ack->complete(false);
+            return false;
+        }
+        // The sender thread serves every lane and peer, so it never waits
+        bool on_sender = std::this_thread::get_id() == sender_thread_.get_id();
+        if (!message.ack && (policy == FlowPolicy::Conflate || on_sender)) {
+            std::string key = policy == FlowPolicy::Conflate ? conflation_key(message.topic, message.content)
+                                                             : std::string();
+            std::lock_guard<std::mutex> lock(rate_mutex_);
+            park(ParkKey{scope, message.topic, key}, message, policy, binding->scope, wait);
+            return false;
+        }
+
+        ++counters.delayed;
+        auto started = std::chrono::steady_clock::now();
+        while (wait.count() > 0) {
+            if (!wait_for_stop(std::chrono::ceil<std::chrono::milliseconds>(wait))) {
+                if (message.ack) message.ack->complete(false);
+                return false;
+            }
+            wait = rate_wait(budgets, bytes).first;
+        }
+        rate_delay_.record(std::chrono::steady_clock::now() - started);
+        if (expired(message.expires)) {
+            count_expired(message.topic, kExpiredSending);
+            if (message.ack) message.ack->complete(false);
+            return false;
+        }
+    }
+    for (const auto& budget : budgets) {
+        budget.limiter->take(bytes);
+    }
+    return true;
+}
+
+void GossipNode::park(const ParkKey& key, const OutboundMessage& message, FlowPolicy policy, RateScope scope,
+                      std::chrono::nanoseconds wait) {
+    auto [it, inserted] = parked_.try_emplace(key);
+    Parked& parked = it->second;
+    if (inserted) {
+        parked.policy = policy;
+        parked.scope = scope;
+        schedule_unpark(key, wait);
+    }
+    if (parked.policy == FlowPolicy::Conflate && !parked.messages.empty()) {
+        ++rate_counters_[parked.scope].conflated;
+        parked.messages.back() = message;
+        return;
+    }
+    if (parked.policy == FlowPolicy::Queue) {
+        ++rate_counters_[parked.scope].delayed;
+    }
+    parked.messages.push_back(message);
+    ++parked_messages_;
+}
+
+// The engine thread only times the wait; the sender thread does the send
+void GossipNode::schedule_unpark(const ParkKey& key, std::chrono::nanoseconds wait) {
+    engine_->post([this, key, wait] {
+        engine_->run_after(std::chrono::ceil<std::chrono::milliseconds>(wait), [this, key] {
+            unparked_.push(key);
+            wake_sender();
+        });
+    });
+}
+
+// Sends parked messages in order while the tokens last. A message for all
+// peers is numbered only now, so numbers follow the order messages leave in.
+void GossipNode::unpark(const ParkKey& key) {
+    const auto& [peer, topic, _] = key;
+    const std::pair<std::string, int>* only = peer.second ? &peer : nullptr;
+    auto budgets = rate_budgets(topic, only);
+    while (running_) {
+        OutboundMessage message;
+        {
+            std::lock_guard<std::mutex> lock(rate_mutex_);
+            auto parked = parked_.find(key);
+            if (parked == parked_.end()) return;
+            auto& messages = parked->second.messages;
+            size_t bytes = messages.front().content.size();
+            auto wait = rate_wait(budgets, bytes).first;
+            if (wait.count() > 0) {
+                schedule_unpark(key, wait); // Other publishers got the tokens first
+                return;
+            }
+            for (const auto& budget : budgets) {
+                budget.limiter->take(bytes);
+            }
+            message = std::move(messages.front());
+            messages.pop_front();
+            --parked_messages_;
+            if (messages.empty()) parked_.erase(parked);
+        }
+        if (expired(message.expires)) {
+            count_expired(topic, kExpiredSending);
+            continue;
+        }
+        if (only) {
+            send_remote(message, {}, nullptr, 0, only, true);
+        } else {
+            message.seq = next_seq(topic, message.content, message.expires);
+            send_remote(message, {}, nullptr, 0);
+        }
+    }
+}
+
+bool GossipNode::send_frame(Connection& conn, const OutboundMessage& message,
+                            std::chrono::steady_clock::time_point deadline, size_t preempt_below) {
+    const std::string& topic = message.topic;
+    const auto& ack = message.ack;
+    std::string path = conn.key.first + ":" + std::to_string(conn.key.second) + "/" + topic;
+
+    // Register the reply this frame will get before sending it
+    ResponseChannel* channel = !conn.peer_acks ? &conn.replies : ack ? &conn.acks : nullptr;
+    if (channel) {
+        std::unique_lock<std::mutex> lock(conn.ack_mutex);
+        if (ack) {
+            size_t window = std::max(1, config_.ack_window);
+            bool space = conn.ack_cv.wait_until(lock, deadline, [&] {
+                return conn.closed || conn.acks.waiting.size() + conn.replies.waiting.size() < window;
+            });
+            if (!space || conn.closed) {
+                return false;
+            }
+            ++ack->remaining;
+            channel->waiting.emplace_back(channel->expected + 1, ack);
+        }
+        ++channel->expected;
+    }
+
+    std::string header;
+    if (conn.deadlines && message.expires != Expiry()) {
+        header += kDeadlinePrefix;
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(message.expires.time_since_epoch());
+        append_varint(header, ms.count());
+    }
+    bool packed = conn.compression && message.packed;
+    auto id = conn.topic_ids.find(topic);
+    if (id != conn.topic_ids.end()) {
+        if (packed) header += kCompressedPrefix;
+        header += conn.peer_acks && ack ? kAckedFrame : conn.sequenced ? kSequencedFrame : kInternedFrame;
+        append_varint(header, id->second);
+        if (conn.sequenced) append_varint(header, message.seq);
+        ++interned_frames_;
+        interned_header_bytes_saved_ += path.size() + 45 - header.size(); // vs. the POST preamble
+    } else {
+        header += "POST /" + path + " HTTP/1.1\r\nContent-Type: text/plain\r\n"; // After the deadline prefix
+        if (conn.interning && conn.topic_ids.size() < kMaxTopicIds) {
+            uint32_t new_id = conn.topic_ids.size();
+            conn.topic_ids[topic] = new_id;
+            header += "Topic-Id: " + std::to_string(new_id) + "\r\n";
+        }
+        if (conn.sequenced) {
+            header += "Publisher-Session: " + session_id_ + "\r\nSeq: " + std::to_string(message.seq) + "\r\n";
+            if (config_.history_depth > 0) {
+                header += "History: 1\r\n";
+            }
+        }
+        if (conn.peer_acks && ack) {
+            header += "Ack: 1\r\n";
+        }
+        if (conn.credits) {
+            header += "Credit: 1\r\n";
+        }
+        if (packed) {
+            header += "Content-Encoding: lz\r\n";
+        }
+        header += "\r\n";
+    }
+    std::string frame = header + (packed ? *message.packed : message.content) + "END238973";
+
+    ++conn.frames_sent;
+    size_t lane = lane_of(conn.lane);
+    ++lane_frames_[lane];
+    lane_bytes_[lane] += frame.size();
+    for (size_t offset = 0; offset < frame.size();) {
+        if (offset > 0 && preempt_below > 0 && has_ingress(preempt_below)) {
+            ++ingress_preemptions_;
+            drain_lanes(preempt_below, nullptr);
+        }
+        size_t chunk = std::min(kChunkSize, frame.size() - offset);
+        ssize_t sent = send(conn.fd, frame.data() + offset, chunk, 0);
+        if (sent <= 0) {
+            throw std::runtime_error("Failed send");
+        }
+        offset += sent;
+    }
+    return true;
+}
+
+FlowPolicy GossipNode::flow_policy(const std::string& topic) const {
+    size_t match = flow_patterns_.first_match(topic);
+    if (match != PatternIndex::npos) {
+        return config_.flow_policies[match].second;
+    }
+    return is_conflated(topic) ? FlowPolicy::Conflate : config_.default_flow_policy;
+}
+
+bool GossipNode::is_conflated(const std::string& topic) const {
+    return conflated_patterns_.any_match(topic);
+}
+
+bool GossipNode::is_compressed(const std::string& topic) const {
+    return compressed_patterns_.any_match(topic);
+}
+
+// Runs on the publishing thread. The entropy sample costs well under a
+// microsecond and saves compressing data that will not shrink.
+std::shared_ptr<const std::string> GossipNode::pack(const std::string& content) {
+    if (content.size() < config_.compression_min_bytes) {
+        ++pack_skipped_small_;
+        return nullptr;
+    }
+    if (!lz_worth_trying(content.data(), content.size())) {
+        ++pack_skipped_entropy_;
+        return nullptr;
+    }
+    auto packed = std::make_shared<std::string>();
+    lz_compress(content.data(), content.size(), *packed);
+    if (packed->size() > content.size() - content.size() / 8) {
+        ++pack_skipped_ratio_;
+        return nullptr;
+    }
+    ++packed_messages_;
+    packed_bytes_in_ += content.size();
+    packed_bytes_out_ += packed->size();
+    return packed;
+}
+
+bool GossipNode::unpack(std::string& content) {
+    std::string unpacked;
+    if (!lz_decompress(content.data(), content.size(), unpacked)) {
+        std::cerr << "Malformed compressed message, dropping.\n";
+        ++unpack_errors_;
+        return false;
+    }
+    content = std::move(unpacked);
+    ++unpacked_messages_;
+    return true;
+}
+
+std::string GossipNode::conflation_key(const std::string& topic, const std::string& content) const {
+    return config_.conflation_key ? config_.conflation_key(topic, content) : std::string();
+}
+
+// Queue never loses an application's message: a publisher that finds
+// credit_queue_limit messages held waits for credits, sending what they allow.
+// The sender thread serves every lane and peer, so it never waits and drops
+// the oldest like Conflate, which is lossy anyway.
+void GossipNode::hold(Connection& conn, OutboundMessage message, std::unique_lock<std::mutex>& send_lock) {
+    if (expired(message.expires)) {
+        count_expired(message.topic, kExpiredSending);
+        if (message.ack) message.ack->complete(false);
+        return;
+    }
+    ++credit_stalls_;
+    FlowPolicy policy = flow_policy(message.topic);
+    if (policy == FlowPolicy::Drop) {
+        ++credit_dropped_;
+        if (message.ack) message.ack->complete(false);
+        return;
+    }
+    if (policy == FlowPolicy::Conflate) {
+        message.key = conflation_key(message.topic, message.content);
+        for (auto& held : conn.held) {
+            if (held.topic == message.topic && held.key == message.key) {
+                ++credit_conflated_;
+                {
+                    std::lock_guard<std::mutex> lock(conflation_mutex_);
+                    ++held_conflated_[message.topic];
+                }
+                if (held.ack) held.ack->complete(false);
+                if (message.ack) ++message.ack->remaining; // Released once sent
+                held.content = std::move(message.content);
+                held.ack = std::move(message.ack);
+                held.expires = message.expires;
+                held.packed = std::move(message.packed);
+                return;
+            }
+        }
+    }
+    size_t limit = std::max<size_t>(1, config_.credit_queue_limit);
+    if (conn.held.size() >= limit) {
+        expire_held(conn); // Room taken by dead messages comes first
+    }
+    bool on_sender = std::this_thread::get_id() == sender_thread_.get_id();
+    while (policy == FlowPolicy::Queue && !on_sender && conn.held.size() >= limit && !conn.closed && running_) {
+        // Woken by the engine on a grant; the timeout covers a grant that
+        // lands between the check and the wait
+        conn.held_cv.wait_for(send_lock, std::chrono::milliseconds(10), [&] {
+            return conn.closed || conn.frames_sent < conn.credit_limit;
+        });
+        flush_held(conn);
+        expire_held(conn);
+    }
+    if (conn.closed) {
+        if (message.ack) message.ack->complete(false);
+        return;
+    }
+    if (conn.held.size() >= limit) {
+        ++credit_dropped_;
+        if (conn.held.front().ack) conn.held.front().ack->complete(false);
+        conn.held.pop_front();
+        --credit_held_;
+    }
+    if (message.ack) ++message.ack->remaining; // Released once sent
+    message.held_since = std::chrono::steady_clock::now();
+    conn.held.push_back(std::move(message));
+    ++credit_held_;
+    if (conn.held.size() > credit_held_peak_) {
+        credit_held_peak_ = conn.held.size();
+    }
+    flush_held(conn); // Credits may have arrived since the check
+}
+
+// Sends held messages while credits last. Never waits: an acked message
+// that finds the ack window full stays at the front until acks come in.
+void GossipNode::flush_held(Connection& conn) {
+    auto now = std::chrono::steady_clock::now();
+    while (!conn.held.empty() && conn.frames_sent < conn.credit_limit) {
+        OutboundMessage& message = conn.held.front();
+        if (expired(message.expires)) {
+            count_expired(message.topic, kExpiredSending);
+            if (message.ack) message.ack->complete(false);
+            conn.held.pop_front();
+            --credit_held_;
+            continue;
+        }
+        if (!send_frame(conn, message, {})) {
+            break;
+        }
+        credit_wait_.record(now - message.held_since);
+        if (message.ack) message.ack->release();
+        conn.held.pop_front();
+        --credit_held_;
+    }
+}
+
+void GossipNode::expire_held(Connection& conn) {
+    for (auto it = conn.held.begin(); it != conn.held.end();) {
+        if (!expired(it->expires)) {
+            ++it;
+            continue;
+        }
+        count_expired(it->topic, kExpiredSending);
+        if (it->ack) it->ack->complete(false);
+        it = conn.held.erase(it);
+        --credit_held_;
+    }
+}
+
+void GossipNode::count_expired(const std::string& topic, ExpiryStage stage) {
+    std::lock_guard<std::mutex> lock(expired_mutex_);
+    ++expired_[topic][stage];
+}
+
+void GossipNode::request_flush(const std::shared_ptr<Connection>& conn) {
+    flush_requests_.push(conn);
+    wake_sender();
+}
+
+// Reads replies and acks on an outbound connection and resolves the
+// publish_acked() calls waiting for them
+void GossipNode::watch_connection(const std::shared_ptr<Connection>& conn) {
+    engine_->post([this, conn] {
+        engine_->add(conn->fd, EPOLLIN, [this, conn](uint32_t) {
+            char buffer[4096];
+            ssize_t n;
+            while ((n = recv(conn->fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+                conn->inbox.append(buffer, n);
+            }
+            bool closed = n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+
+            std::vector<std::shared_ptr<PendingAck>> acked;
+            bool credited = false;
+            {
+                std::lock_guard<std::mutex> lock(conn->ack_mutex);
+                size_t end;
+                while ((end = conn->inbox.find("\r\n\r\n")) != std::string::npos) {
+                    if (conn->inbox.compare(0, 4, "ACK ") == 0) {
+                        uint64_t count = std::strtoull(conn->inbox.c_str() + 4, nullptr, 10);
+                        conn->acks.received = std::max(conn->acks.received, count);
+                    } else if (conn->inbox.compare(0, 7, "CREDIT ") == 0) {
+                        uint64_t limit = std::strtoull(conn->inbox.c_str() + 7, nullptr, 10);
+                        if (limit > conn->credit_limit) conn->credit_limit = limit;
+                        credited = true;
+                    } else if (conn->inbox.compare(0, 7, "RESEND ") == 0) {
+                        char* rest;
+                        uint64_t from = std::strtoull(conn->inbox.c_str() + 7, &rest, 10);
+                        uint64_t to = std::strtoull(rest, &rest, 10);
+                        if (*rest == ' ') {
+                            size_t topic_start = rest + 1 - conn->inbox.c_str();
+                            std::string topic = conn->inbox.substr(topic_start, end - topic_start);
+                            resend_requests_.push(ResendRequest{conn->key, topic, from, to});
+                            wake_sender();
+                        }
+                    } else {
+                        ++conn->replies.received; // One HTTP status line per frame
+                    }
+                    conn->inbox.erase(0, end + 4);
+                }
+                for (auto* channel : {&conn->acks, &conn->replies}) {
+                    while (!channel->waiting.empty() && channel->waiting.front().first <= channel->received) {
+                        acked.push_back(std::move(channel->waiting.front().second));
+                        channel->waiting.pop_front();
+                    }
+                }
+            }
+            conn->ack_cv.notify_all();
+            for (auto& ack : acked) {
+                ack->release();
+            }
+            if (credited || !acked.empty()) {
+                request_flush(conn); // Held messages may fit now
+                conn->held_cv.notify_all();
+            }
+
+            if (closed) {
+                drop_connection(conn);
+                engine_->remove(conn->fd); // Last reference closes the socket
+            }
+        });
+    });
+}
+
+void GossipNode::drop_connection(const std::shared_ptr<Connection>& conn) {
+    {
+        std::lock_guard<std::mutex> lock(conn_mutex_);
+        auto it = socket_pool_.find({conn->key, conn->lane});
+        if (it != socket_pool_.end() && it->second == conn) {
+            socket_pool_.erase(it); // Reconnect rebinds topic IDs from scratch
+        }
+    }
+    shutdown(conn->fd, SHUT_RDWR); // The engine sees EOF and lets go of it
+    fail_pending(*conn);
+}
+
+// closed is set first: a sender waiting in the ack window under send_mutex
+// gives up, and a hold() woken later sees it rather than an empty queue.
+void GossipNode::fail_pending(Connection& conn) {
+    std::vector<std::shared_ptr<PendingAck>> failed;
+    {
+        std::lock_guard<std::mutex> lock(conn.ack_mutex);
+        conn.closed = true;
+        for (auto* channel : {&conn.acks, &conn.replies}) {
+            for (auto& waiting : channel->waiting) {
+                failed.push_back(std::move(waiting.second));
+            }
+            channel->waiting.clear();
+        }
+    }
+    conn.ack_cv.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(conn.send_mutex);
+        for (auto& message : conn.held) {
+            if (message.ack) failed.push_back(std::move(message.ack));
+        }
+        credit_held_ -= conn.held.size();
+        conn.held.clear();
+    }
+    conn.held_cv.notify_all();
+    for (auto& ack : failed) {
+        ack->complete(false);
+    }
+}
+
+void GossipNode::deliver_local(const std::string& topic, const std::string& content,
+                               const std::shared_ptr<InboundConnection>& from, Expiry expires) {
+    if (from && config_.last_value_relay && config_.last_value_cache_bytes > 0) {
+        cache_last_value(topic, content, 0, expires);
+    }
+    if (dispatch_) {
+        Callbacks callbacks = subscriptions_.resolve(topic);
+        if (!callbacks.empty()) {
+            dispatch(dispatch_->strand(topic), topic, content, std::move(callbacks), from, expires);
+        } else if (from) {
+            frame_done(*from);
+        }
+        return;
+    }
+    if (expired(expires)) {
+        count_expired(topic, kExpiredReceiving);
+        if (from) frame_done(*from);
+        return;
+    }
+    subscriptions_.match(topic, [&](const Callback& cb) {
+        cb(topic, content);
+    });
+    if (from) frame_done(*from);
+}
+
+// Called in stream order (under the stream mutex for sequenced messages), so
+// posting to the topic's strand keeps that order on the pool
+void GossipNode::dispatch(DispatchPool::Strand* strand, const std::string& topic, std::string content, Callbacks callbacks,
+                          const std::shared_ptr<InboundConnection>& from, Expiry expires) {
+    if (expired(expires)) {
+        count_expired(topic, kExpiredReceiving);
+        if (from) frame_done(*from);
+        return;
+    }
+    if (!strand) {
+        for (const auto& cb : callbacks) {
+            (*cb)(topic, content);
+        }
+        if (from) frame_done(*from);
+        return;
+    }
+    if (!config_.conflated_topics.empty() && is_conflated(topic)) {
+        conflate(strand, topic, std::move(content), std::move(callbacks), from, expires);
+        return;
+    }
+    // Credits come back when the callbacks have run, not when they are queued
+    dispatch_->post(strand, [this, topic, content = std::move(content), callbacks = std::move(callbacks), from,
+                             expires] {
+        if (expired(expires)) {
+            count_expired(topic, kExpiredReceiving); // Waited too long in the queue
+            if (from) frame_done(*from);
+            return;
+        }
+        for (const auto& cb : callbacks) {
+            (*cb)(topic, content);
+        }
+        if (from) frame_done(*from);
+    });
+}
+
+// Drops slots with nothing pending that no dispatch task holds, keeping
+// their counts per topic, so keys that come and go do not pile up. Runs once
+// the map has doubled since the last sweep. Caller holds conflation_mutex_.
+void GossipNode::sweep_conflation_slots() {
+    for (auto it = conflation_slots_.begin(); it != conflation_slots_.end();) {
+        if (it->second.use_count() == 1) {
+            std::lock_guard<std::mutex> slot_lock(it->second->mutex);
+            if (!it->second->pending) {
+                auto& totals = conflation_totals_[it->first.first];
+                totals.first += it->second->received;
+                totals.second += it->second->conflated;
+                it = conflation_slots_.erase(it);
+                continue;
+            }
+        }
+        ++it;
+    }
+    conflation_sweep_at_ = std::max(kConflationSweepMin, 2 * conflation_slots_.size());
+}
+
+// A replaced message counts as done for credits right away; the connection
+// that sent the delivered value gets its credit once the callbacks have run.
+void GossipNode::conflate(DispatchPool::Strand* strand, const std::string& topic, std::string content, Callbacks callbacks,
+                          const std::shared_ptr<InboundConnection>& from, Expiry expires) {
+    std::string key = conflation_key(topic, content);
+    std::shared_ptr<ConflationSlot> slot;
+    {
+        std::lock_guard<std::mutex> lock(conflation_mutex_);
+        auto it = conflation_slots_.find({topic, key});
+        if (it == conflation_slots_.end()) {
+            if (conflation_slots_.size() >= conflation_sweep_at_) {
+                sweep_conflation_slots();
+            }
+            it = conflation_slots_.emplace(std::make_pair(topic, key), std::make_shared<ConflationSlot>()).first;
+        }
+        slot = it->second;
+    }
+
+    std::shared_ptr<InboundConnection> replaced;
+    bool post;
+    {
+        std::lock_guard<std::mutex> lock(slot->mutex);
+        ++slot->received;
+        post = !slot->pending;
+        if (slot->pending) {
+            ++slot->conflated;
+            replaced = std::exchange(slot->from, from);
+        } else {
+            slot->pending = true;
+            slot->from = from;
+        }
+        slot->content = std::move(content);
+        slot->callbacks = std::move(callbacks);
+        slot->expires = expires;
+    }
+    if (replaced) frame_done(*replaced);
+    if (!post) return;
+
+    dispatch_->post(strand, [this, topic, slot] {
+        std::string content;
+        Callbacks callbacks;
+        std::shared_ptr<InboundConnection> from;
+        Expiry expires;
+        {
+            std::lock_guard<std::mutex> lock(slot->mutex);
+            content = std::move(slot->content);
+            callbacks = std::move(slot->callbacks);
+            from = std::move(slot->from);
+            expires = slot->expires;
+            slot->pending = false;
+        }
+        if (expired(expires)) {
+            count_expired(topic, kExpiredReceiving);
+            if (from) frame_done(*from);
+            return;
+        }
+        for (const auto& cb : callbacks) {
+            (*cb)(topic, content);
+        }
+        if (from) frame_done(*from);
+    });
+}
+
+
+// Peers that want a topic when it first enters the cache got its messages
+// live, so they count as served already
+void GossipNode::cache_last_value(const std::string& topic, const std::string& content, uint64_t seq,
+                                  Expiry expires) {
+    std::lock_guard<std::mutex> lock(last_values_mutex_);
+    auto it = last_values_.find(topic);
+    if (it != last_values_.end()) {
+        last_value_bytes_ -= it->second.content.size();
+        last_value_order_.erase(it->second.recent);
+        if (content.size() > config_.last_value_cache_bytes) {
+            last_values_.erase(it); // Too big to keep; a stale value would be wrong
+            return;
+        }
+        it->second.content = content;
+        it->second.seq = seq;
+        it->second.expires = expires;
+    } else {
+        if (content.size() > config_.last_value_cache_bytes) return;
+        it = last_values_.emplace(topic, LastValue{content, seq, expires, {}}).first;
+        auto members = membership_.read();
+        for (const auto& node : members->known_nodes) {
+            if (node_wants_topic(node, topic)) {
+                last_value_served_[{node.ip, node.port}].insert(topic);
+            }
+        }
+    }
+    last_value_order_.push_front(topic);
+    it->second.recent = last_value_order_.begin();
+    last_value_bytes_ += content.size();
+
+    while (last_value_bytes_ > config_.last_value_cache_bytes) {
+        auto evicted = last_values_.find(last_value_order_.back());
+        last_value_bytes_ -= evicted->second.content.size();
+        last_values_.erase(evicted);
+        last_value_order_.pop_back();
+        ++last_value_evictions_;
+    }
+}
+
+void GossipNode::membership_changed() {
+    if (config_.last_value_cache_bytes == 0) return;
+    last_values_dirty_ = true;
+    wake_sender();
+}
+
+// Compares what each peer wants now with the last check; a newly wanted
+// topic gets its cached value, and a topic no longer wanted is forgotten so a
+// later subscription gets it again.
+void GossipNode::push_last_values() {
+    std::vector<std::pair<PeerKey, OutboundMessage>> due;
+    {
+        auto members = membership_.read();
+        std::lock_guard<std::mutex> lock(last_values_mutex_);
+        for (const auto& node : members->known_nodes) {
+            PeerKey peer{node.ip, node.port};
+            auto& served = last_value_served_[peer];
+            for (const auto& [topic, value] : last_values_) {
+                if (!node_wants_topic(node, topic)) {
+                    served.erase(topic);
+                } else if (served.insert(topic).second && !expired(value.expires)) {
+                    due.push_back({peer, OutboundMessage{topic, value.content, value.seq, nullptr, {}, {}, value.expires, {}}});
+                }
+            }
+        }
+    }
+    for (const auto& [peer, message] : due) {
+        send_remote(message, {}, nullptr, 0, &peer);
+        ++last_value_pushes_;
+    }
+}
+
+void GossipNode::serve_last_values(const PeerKey& peer, const std::string& pattern) {
+    std::vector<OutboundMessage> values;
+    {
+        std::lock_guard<std::mutex> lock(last_values_mutex_);
+        for (const auto& [topic, value] : last_values_) {
+            if (TopicTrie<int>::matches(pattern, topic)) {
+                last_value_served_[peer].insert(topic);
+                if (expired(value.expires)) continue;
+                values.push_back(OutboundMessage{topic, value.content, value.seq, nullptr, {}, {}, value.expires, {}});
+            }
+        }
+    }
+    for (const auto& message : values) {
+        send_remote(message, {}, nullptr, 0, &peer);
+        ++last_value_requests_served_;
+    }
+}
+
+void GossipNode::publish_series(const std::string& topic, double value, std::chrono::system_clock::time_point time) {
+    add_series_point(topic, time, value, 0, false);
+}
+
+// The first point of a window starts its timer; a full window or a change of
+// type closes the block right away
+void GossipNode::add_series_point(const std::string& topic, std::chrono::system_clock::time_point time,
+                                  double value, int64_t integer, bool is_integer) {
+    ++series_points_;
+    uint64_t due = ~0ULL;  // Window whose timer to start
+    bool closed = false;
+    {
+        std::lock_guard<std::mutex> lock(series_mutex_);
+        Series& series = series_[topic];
+        if (series.encoder.size() > 0 && series.encoder.integers() != is_integer) {
+            series.ready.push_back(series.encoder.finish());
+            ++series.window;
+            closed = true;
+        }
+        if (is_integer) {
+            series.encoder.add(time, integer);
+        } else {
+            series.encoder.add(time, value);
+        }
+        if (series.encoder.size() == 1) {
+            due = series.window;
+        }
+        if (series.encoder.size() >= std::max<size_t>(1, config_.series_max_points)) {
+            series.ready.push_back(series.encoder.finish());
+            ++series.window;
+            closed = true;
+        }
+    }
+    if (closed) {
+        series_due_.push({topic, ~0ULL});
+        wake_sender();
+    }
+    if (due != ~0ULL) {
+        engine_->post([this, topic, due] {
+            engine_->run_after(config_.series_window, [this, topic, due] {
+                series_due_.push({topic, due});
+                wake_sender();
+            });
+        });
+    }
+}
+
+void GossipNode::send_series(const std::string& topic, uint64_t window) {
+    std::deque<std::string> blocks;
+    {
+        std::lock_guard<std::mutex> lock(series_mutex_);
+        Series& series = series_[topic];
+        if (series.window == window && series.encoder.size() > 0) {
+            series.ready.push_back(series.encoder.finish());
+            ++series.window;
+        }
+        blocks.swap(series.ready);
+    }
+    for (const auto& block : blocks) {
+        ++series_blocks_;
+        series_bytes_ += block.size();
+        publish(topic, block);
+    }
+}
+
+// Only the newest history_depth sequence numbers can still be in history
+void GossipNode::serve_resend(const ResendRequest& request) {
+    ++history_requests_;
+    TopicHistory* history = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(publish_seqs_mutex_);
+        auto it = publish_seqs_.find(request.topic);
+        if (it != publish_seqs_.end()) history = it->second.history.get();
+    }
+    uint64_t from = request.from;
+    if (!history || request.to < from) {
+        history_missed_ += request.to >= from ? request.to - from + 1 : 0;
+        return;
+    }
+    if (request.to - from >= history->depth()) {
+        history_missed_ += request.to - from + 1 - history->depth();
+        from = request.to - history->depth() + 1;
+    }
+    std::string content;
+    Expiry expires;
+    for (uint64_t seq = from; seq <= request.to; ++seq) {
+        if (!history->get(seq, content, expires)) {
+            ++history_missed_;
+            continue;
+        }
+        if (expired(expires)) {
+            count_expired(request.topic, kExpiredSending); // Too late to matter now
+            continue;
+        }
+        send_remote(OutboundMessage{request.topic, content, seq, nullptr, {}, {}, expires, {}}, {}, nullptr, 0,
+                    &request.peer);
+        ++history_resent_;
+    }
+}
+
+std::shared_ptr<TopicLog> GossipNode::topic_log(const std::string& topic) {
+    if (config_.topic_log_dir.empty()) return nullptr;
+    std::lock_guard<std::mutex> lock(topic_logs_mutex_);
+    auto [it, inserted] = topic_logs_.try_emplace(topic);
+    if (inserted) {
+        // An empty topic would log into topic_log_dir itself
+        if (!topic.empty() && logged_patterns_.any_match(topic)) {
+            // "." and ".." name existing directories, so their dots are escaped
+            bool dots = topic.find_first_not_of('.') == std::string::npos;
+            std::string dir;
+            for (char c : topic) {
+                if (c == '/' || c == '%') {
+                    dir += c == '/' ? "%2F" : "%25";
+                } else if (c == '.' && dots) {
+                    dir += "%2E";
+                } else {
+                    dir += c;
+                }
+            }
+            it->second = std::make_shared<TopicLog>(config_.topic_log_dir + "/" + dir, config_.topic_log);
+        }
+    }
+    return it->second;
+}
+
+// While topics are being published the writer polls every kLogPoll, so
+// publishers never pay for a wakeup; after kLogIdlePolls empty polls it
+// sleeps until woken, with the sleep protocol of the sender thread (see
+// wake_sender()).
+void GossipNode::write_logs() {
+    constexpr auto kLogPoll = std::chrono::milliseconds(1);
+    constexpr int kLogIdlePolls = 100;
+    LogAppend append;
+    int idle = 0;
+    while (true) {
+        bool wrote = false;
+        while (log_appends_.pop(append)) {
+            append.log->append(append.content, append.time);
+            wrote = true;
+        }
+        append.log.reset();
+        if (!running_) break;
+
+        idle = wrote ? 0 : idle + 1;
+        std::unique_lock<std::mutex> lock(log_mutex_);
+        if (idle < kLogIdlePolls) {
+            log_cv_.wait_for(lock, kLogPoll, [this] { return !running_.load(); });
+            continue;
+        }
+        log_sleeping_ = true;
+        log_cv_.wait(lock, [this] { return !running_ || !log_appends_.empty(); });
+        log_sleeping_ = false;
+        idle = 0;
+    }
+}
+
+void GossipNode::request_last_values(const std::string& topic) {
+    auto members = membership_.read();
+    std::string request = "GET /last/" + topic + " HTTP/1.1\r\n\r\n" + record_json(members->self).dump() + "END238973";
+    for (const auto& node : members->known_nodes) {
+        if (!node.has_capability("last_values")) continue;
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0) return;
+        set_priority(sock, Priority::Control);
+        timeval timeout{2, 0};
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(node.port);
+        inet_pton(AF_INET, node.ip.c_str(), &addr.sin_addr);
+        if (connect(sock, (sockaddr*)&addr, sizeof(addr)) == 0) {
+            send(sock, request.data(), request.size(), MSG_NOSIGNAL); // The values come back as publishes
+        }
+        close(sock);
+    }
+}
+
+GossipNode::SubscriptionId GossipNode::subscribe(const std::string& topic, std::function<void(const std::string&, const std::string&)> callback) {
+    auto subscribed_at = std::chrono::steady_clock::now();
+    auto first = std::make_shared<std::atomic<bool>>(false);
+    SubscriptionId id = subscriptions_.add(topic, [this, callback = std::move(callback), subscribed_at, first](
+                                                      const std::string& message_topic, const std::string& content) {
+        if (!first->load(std::memory_order_relaxed) && !first->exchange(true)) {
+            first_message_latency_.record(std::chrono::steady_clock::now() - subscribed_at);
+        }
+        callback(message_topic, content);
+    });
+    membership_.update([&](Membership& m) {
+        if (!m.self.add_topic(topic)) return false;
+        ++m.self.topics_version;
+        return true;
+    });
+    return id;
+}
+
+GossipNode::SubscriptionId GossipNode::subscribe_series(const std::string& topic, SeriesCallback callback) {
+    return subscribe(topic, [this, callback = std::move(callback)](const std::string& message_topic,
+                                                                   const std::string& content) {
+        std::vector<SeriesPoint> points;
+        if (!decode_series(content, points)) {
+            ++series_errors_;
+            return;
+        }
+        series_received_ += points.size();
+        for (const auto& point : points) {
+            callback(message_topic, point);
+        }
+    });
+}
+
+std::unique_ptr<TopicQueue> GossipNode::open_queue(const std::string& topic, size_t capacity, QueuePolicy policy) {
+    std::unique_ptr<TopicQueue> queue(new TopicQueue(capacity, policy));
+    SubscriptionId id = subscribe(topic, [state = queue->state_](const std::string& message_topic, const std::string& content) {
+        state->push(message_topic, content);
+    });
+    queue->unsubscribe_ = [this, id] { unsubscribe(id); };
+    return queue;
+}
+
+// Stops advertising the topic once its last callback is gone. Bumping
+// topics_version makes peers replace their copy of our list, so they stop
+// sending once gossip reaches them; deliver_local drops what arrives before.
+void GossipNode::unsubscribe(SubscriptionId id) {
+    std::string topic;
+    if (!subscriptions_.remove(id, topic)) {
+        return;
+    }
+    // Checked inside the update so a concurrent subscribe() to the same topic
+    // cannot be undone: membership updates are serialized.
+    membership_.update([&](Membership& m) {
+        if (subscriptions_.contains(topic) || !m.self.remove_topic(topic)) return false;
+        ++m.self.topics_version;
+        return true;
+    });
+}
+
+// Each round hands queries to gossip_fanout random peers to the I/O engine,
+// which runs them concurrently. Nothing here holds conn_mutex_, so publish()
+// never waits behind a membership round trip.
+void GossipNode::update_known_nodes_periodically() {
+    std::mt19937 rng(std::random_device{}());
+    do {
+        {
+            auto m = membership_.load();
+            std::vector<const PeerRecord*> targets;
+            for (const auto& node : m->known_nodes) {
+                targets.push_back(&node);
+            }
+            std::shuffle(targets.begin(), targets.end(), rng);
+            targets.resize(std::min<size_t>(targets.size(), std::max(1, config_.gossip_fanout)));
+
+            for (const auto* node : targets) {
+                engine_->post([this, ip = node->ip, port = node->port] {
+                    query_node_for_info(ip, port);
+                });
+            }
+        }
+
+        std::set<std::pair<std::string, int>> fetches;
+        {
+            std::lock_guard<std::mutex> lock(summary_mutex_);
+            fetches.swap(pending_topic_fetches_);
+        }
+        for (const auto& [ip, port] : fetches) {
+            fetch_exact_topics(ip, port);
+        }
+    } while (wait_for_stop(std::chrono::seconds(1)));
+}
+
+// Sleeps for the given time; returns false once the node is shutting down.
+bool GossipNode::wait_for_stop(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(stop_mutex_);
+    return !stop_cv_.wait_for(lock, timeout, [this] { return !running_; });
+}
+
+void GossipNode::repair_membership_periodically() {
+    // Anti-entropy is background work; keep it out of the way of the data path.
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+
+    std::mt19937 rng(std::random_device{}());
+    while (wait_for_stop(std::chrono::seconds(5))) {
+        auto m = membership_.load();
+        if (m->known_nodes.empty()) continue;
+
+        const auto& node = m->known_nodes[rng() % m->known_nodes.size()];
+        repair_membership_with(node.ip, node.port);
+    }
+}
+
+// Walks the Merkle tree level by level against one peer, only descending into
+// subtrees whose hashes differ, then swaps the records of the differing leaves.
+// That is kDigestDepth + 1 round trips regardless of how many records agree.
+void GossipNode::repair_membership_with(const std::string& ip, int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return;
+    set_priority(sock, Priority::Control);
+
+    try {
+        timeval timeout{2, 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+
+        if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            close(sock);
+            return;
+        }
+
+        MembershipDigest mine(gossip_info());
+        json frontier = {{"", mine.hash("")}};
+        std::string response;
+        ++digest_rounds_;
+
+        for (size_t level = 0; level < kDigestDepth && !frontier.empty(); ++level) {
+            std::string request = "GET /digest\r\n\r\n" + json{{"hashes", frontier}}.dump() + "END238973";
+            if (!exchange(sock, request, response)) break;
+            digest_bytes_ += request.size() + response.size();
+
+            json remote = json::parse(response);
+            json next = json::object();
+            for (const auto& [path, hashes] : remote["children"].items()) {
+                for (int d = 0; d < kDigestFanout; ++d) {
+                    std::string child = path + kHexDigits[d];
+                    if (hashes[d].get<uint64_t>() != mine.hash(child)) {
+                        next[child] = mine.hash(child);
+                    }
+                }
+            }
+            frontier = next;
+        }
+
+        if (!frontier.empty()) {
+            json entries = json::object();
+            for (const auto& [leaf, _] : frontier.items()) {
+                entries[leaf] = mine.entries.count(leaf) ? mine.entries[leaf] : json::array();
+            }
+            std::string request = "GET /digest\r\n\r\n" + json{{"entries", entries}}.dump() + "END238973";
+            if (exchange(sock, request, response)) {
+                digest_bytes_ += request.size() + response.size();
+                json remote = json::parse(response);
+                std::vector<json> records;
+                for (const auto& [_, leaf_records] : remote["entries"].items()) {
+                    records.insert(records.end(), leaf_records.begin(), leaf_records.end());
+                }
+                merge_known_nodes(records);
+                digest_repaired_entries_ += records.size();
+            }
+        }
+    } catch (...) {
+        // Peer went away mid-repair; the next round will retry
+    }
+    close(sock);
+}
+
+std::string GossipNode::handle_digest_request(const std::string& payload) {
+    json response = json::object();
+    try {
+        json request = json::parse(payload);
+        MembershipDigest mine(gossip_info());
+
+        if (request.contains("hashes")) {
+            response["children"] = json::object();
+            for (const auto& [path, hash] : request["hashes"].items()) {
+                if (path.size() < kDigestDepth && hash.get<uint64_t>() != mine.hash(path)) {
+                    response["children"][path] = mine.children(path);
+                }
+            }
+        }
+        if (request.contains("entries")) {
+            response["entries"] = json::object();
+            std::vector<json> records;
+            for (const auto& [leaf, leaf_records] : request["entries"].items()) {
+                response["entries"][leaf] = mine.entries.count(leaf) ? mine.entries[leaf] : json::array();
+                records.insert(records.end(), leaf_records.begin(), leaf_records.end());
+            }
+            merge_known_nodes(records);
+            digest_repaired_entries_ += records.size();
+        }
+    } catch (...) {
+        std::cerr << "Failed to parse JSON in GET /digest.\n";
+    }
+    return response.dump();
+}
+void GossipNode::query_node_for_info(const std::string& ip, int port) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock < 0) return;
+    set_priority(sock, Priority::Control);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+
+    if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        close(sock);
+        ++full_gossip_failures_;
+        return;
+    }
+
+    auto query = std::make_shared<InfoQuery>();
+    query->fd = sock;
+    query->request = "GET /info\r\n\r\n" + gossip_info(true).dump() + "END238973";
+    ++full_gossip_rounds_;
+
+    // Removing the handler drops the last reference to the query and closes it
+    query->timer = engine_->run_after(kQueryTimeout, [this, sock] {
+        ++full_gossip_failures_;
+        engine_->remove(sock);
+    });
+    auto finish = [this, query] {
+        engine_->cancel(query->timer);
+        engine_->remove(query->fd);
+    };
+
+    engine_->add(sock, EPOLLOUT, [this, query, finish](uint32_t events) {
+        if (query->sent < query->request.size()) {
+            ssize_t n = send(query->fd, query->request.data() + query->sent,
+                             query->request.size() - query->sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EAGAIN) return;
+            if (n <= 0 || (events & EPOLLERR)) {
+                ++full_gossip_failures_;
+                finish();
+                return;
+            }
+            query->sent += n;
+            if (query->sent == query->request.size()) {
+                engine_->modify(query->fd, EPOLLIN);
+            }
+            return;
+        }
+
+        char buffer[4096];
+        ssize_t n;
+        while ((n = recv(query->fd, buffer, sizeof(buffer), 0)) > 0) {
+            query->response.append(buffer, n);
+        }
+
+        // Responses are a bare JSON document (no end marker), and the peer keeps
+        // the connection open, so the reply is complete once it parses.
+        auto json_start = query->response.find('{');
+        if (json_start != std::string::npos &&
+            json::accept(query->response.begin() + json_start, query->response.end())) {
+            full_gossip_bytes_ += query->request.size() + query->response.size();
+            try {
+                json remote_info = json::parse(query->response.begin() + json_start, query->response.end());
+                std::vector<json> records{remote_info["self"]};
+                for (const auto& node : remote_info["known_nodes"]) {
+                    records.push_back(node);
+                }
+                merge_known_nodes(records);
+            } catch (...) {
+                ++full_gossip_failures_;
+            }
+            finish();
+        } else if (n == 0 || (n < 0 && errno != EAGAIN)) {
+            ++full_gossip_failures_; // Closed before a full reply
+            finish();
+        }
+    });
+}
+
+
+void GossipNode::connect_async(const std::string& ip, int port, std::function<void(bool)> done) {
+    {
+        std::lock_guard<std::mutex> lock(conn_mutex_);
+        if (socket_pool_.count({{ip, port}, Priority::Normal})) {
+            done(true);
+            return;
+        }
+    }
+
+    engine_->post([this, ip, port, done] {
+        int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (sock < 0) {
+            done(false);
+            return;
+        }
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+
+        if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+            close(sock);
+            done(false);
+            return;
+        }
+
+        auto timer = std::make_shared<uint64_t>();
+        *timer = engine_->run_after(kQueryTimeout, [this, sock, done] {
+            engine_->remove(sock);
+            close(sock);
+            done(false);
+        });
+        engine_->add(sock, EPOLLOUT, [this, sock, ip, port, done, timer](uint32_t) {
+            engine_->cancel(*timer);
+            engine_->remove(sock);
+
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+                close(sock);
+                done(false);
+                return;
+            }
+
+            // publish() writes to pooled sockets with blocking sends
+            fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+            bool pooled = false;
+            {
+                std::lock_guard<std::mutex> lock(conn_mutex_);
+                auto& conn = socket_pool_[{{ip, port}, Priority::Normal}];
+                if (!conn) {
+                    set_priority(sock, Priority::Normal);
+                    conn = std::make_shared<Connection>();
+                    conn->fd = sock;
+                    conn->key = {ip, port};
+                    watch_connection(conn);
+                    pooled = true;
+                }
+            }
+            if (!pooled) {
+                close(sock); // publish() connected first
+            }
+            done(true);
+        });
+    });
+}
+
+std::string GossipNode::get_info_json() const {
+    auto m = membership_.read();
+    json info;
+    info["self"] = record_json(m->self);
+    info["known_nodes"] = json::array();
+    for (const auto& node : m->known_nodes) {
+        info["known_nodes"].push_back(record_json(node));
+    }
+    return info.dump(4);
+}
+
+std::string GossipNode::get_stats_json() const {
+    json stats;
+    stats["gossip"]["full_state"] = {
+        {"rounds", full_gossip_rounds_.load()},
+        {"failures", full_gossip_failures_.load()},
+        {"bytes", full_gossip_bytes_.load()}
+    };
+    stats["gossip"]["digest"] = {
+        {"rounds", digest_rounds_.load()},
+        {"bytes", digest_bytes_.load()},
+        {"repaired_entries", digest_repaired_entries_.load()}
+    };
+
+    double uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_at_).count();
+    stats["listeners"] = json::array();
+    uint64_t accepts = 0;
+    for (const auto& listener : listeners_) {
+        accepts += listener->accepts;
+        stats["listeners"].push_back({
+            {"accepts", listener->accepts.load()},
+            {"backlog_full", listener->backlog_full.load()},
+            {"peak_queue", listener->peak_queue.load()}
+        });
+    }
+    stats["accept"] = {
+        {"backlog", config_.listen_backlog},
+        {"accepts", accepts},
+        {"accepts_per_second", uptime > 0 ? accepts / uptime : 0.0},
+        {"listen_overflows_system", read_listen_overflows() - listen_overflows_at_start_}
+    };
+
+    stats["publish_latency"] = publish_latency_.to_json();
+
+    stats["series"] = {
+        {"points", series_points_.load()},
+        {"blocks", series_blocks_.load()},
+        {"bytes", series_bytes_.load()},
+        {"received_points", series_received_.load()},
+        {"errors", series_errors_.load()}
+    };
+
+    stats["compression"] = {
+        {"topics", config_.compressed_topics},
+        {"compressed", packed_messages_.load()},
+        {"bytes_in", packed_bytes_in_.load()},
+        {"bytes_out", packed_bytes_out_.load()},
+        {"skipped_small", pack_skipped_small_.load()},
+        {"skipped_entropy", pack_skipped_entropy_.load()},
+        {"skipped_ratio", pack_skipped_ratio_.load()},
+        {"decompressed", unpacked_messages_.load()},
+        {"errors", unpack_errors_.load()}
+    };
+
+    stats["ingress"] = {
+        {"sent", ingress_sent_.load()},
+        {"wakeups", ingress_wakeups_.load()},
+        {"largest_drain", ingress_largest_drain_.load()},
+        {"preemptions", ingress_preemptions_.load()}
+    };
+
+    const char* lane_names[kDataLanes] = {"high", "normal", "bulk"};
+    for (size_t lane = 0; lane < kDataLanes; ++lane) {
+        stats["lanes"][lane_names[lane]] = {
+            {"frames", lane_frames_[lane].load()},
+            {"bytes", lane_bytes_[lane].load()}
+        };
+    }
+
+    stats["subscriptions"] = {
+        {"count", subscriptions_.size()},
+        {"version", subscriptions_.version()}
+    };
+
+    stats["streams"] = {
+        {"session", session_id_},
+        {"inbound", json::array()}
+    };
+    uint64_t lost = 0, stale = 0;
+    {
+        std::lock_guard<std::mutex> lock(streams_mutex_);
+        for (const auto& entry : inbound_streams_) {
+            const InboundStream& stream = *entry.second;
+            lost += stream.lost;
+            stale += stream.stale;
+            stats["streams"]["inbound"].push_back({
+                {"publisher", stream.publisher},
+                {"topic", stream.topic},
+                {"last_seq", stream.last_seq.load()},
+                {"delivered", stream.delivered.load()},
+                {"lost", stream.lost.load()},
+                {"stale", stream.stale.load()},
+                {"recovered", stream.recovered.load()}
+            });
+        }
+    }
+    stats["streams"]["lost"] = lost;
+    stats["streams"]["stale"] = stale;
+    stats["streams"]["history"] = {
+        {"depth", config_.history_depth},
+        {"requests", history_requests_.load()},
+        {"resent", history_resent_.load()},
+        {"missed", history_missed_.load()}
+    };
+
+    stats["threads"] = thread_stats_->to_json();
+    stats["dispatch"] = dispatch_ ? dispatch_->to_json() : json{{"threads", 0}};
+
+    stats["flow_control"] = {
+        {"stalls", credit_stalls_.load()},
+        {"held", credit_held_.load()},
+        {"held_peak", credit_held_peak_.load()},
+        {"dropped", credit_dropped_.load()},
+        {"conflated", credit_conflated_.load()},
+        {"grants_sent", credit_grants_.load()},
+        {"credit_wait", credit_wait_.to_json()}
+    };
+
+    // Conflation ratio: share of the messages on a topic replaced by a newer
+    // value before delivery
+    json conflation = json::object();
+    {
+        std::lock_guard<std::mutex> lock(conflation_mutex_);
+        std::map<std::string, std::pair<uint64_t, uint64_t>> topics = conflation_totals_;
+        for (const auto& [key, slot] : conflation_slots_) {
+            std::lock_guard<std::mutex> slot_lock(slot->mutex);
+            topics[key.first].first += slot->received;
+            topics[key.first].second += slot->conflated;
+        }
+        for (const auto& [topic, counts] : topics) {
+            conflation[topic] = {
+                {"received", counts.first},
+                {"conflated", counts.second},
+                {"ratio", counts.first ? double(counts.second) / counts.first : 0.0}
+            };
+        }
+        for (const auto& [topic, count] : held_conflated_) {
+            conflation[topic]["held_conflated"] = count;
+        }
+    }
+    stats["conflation"] = conflation;
+
+    const char* scope_names[kRateScopes] = {"node", "topic", "peer"};
+    for (int scope = 0; scope < kRateScopes; ++scope) {
+        const RateCounters& counters = rate_counters_[scope];
+        stats["rate_limits"][scope_names[scope]] = {
+            {"limited", counters.limited.load()},
+            {"delayed", counters.delayed.load()},
+            {"dropped", counters.dropped.load()},
+            {"conflated", counters.conflated.load()}
+        };
+    }
+    stats["rate_limits"]["parked"] = parked_messages_.load();
+    stats["rate_limits"]["delay"] = rate_delay_.to_json();
+
+    {
+        std::lock_guard<std::mutex> lock(last_values_mutex_);
+        stats["last_values"] = {
+            {"topics", last_values_.size()},
+            {"bytes", last_value_bytes_},
+            {"cap", config_.last_value_cache_bytes},
+            {"evictions", last_value_evictions_.load()},
+            {"pushed", last_value_pushes_.load()},
+            {"requests_served", last_value_requests_served_.load()}
+        };
+    }
+    stats["time_to_first_message"] = first_message_latency_.to_json();
+
+    json logs = json::object();
+    {
+        std::lock_guard<std::mutex> lock(topic_logs_mutex_);
+        for (const auto& [topic, log] : topic_logs_) {
+            if (log) logs[topic] = log->to_json();
+        }
+    }
+    stats["topic_logs"] = logs;
+
+    json expired_topics = json::object();
+    uint64_t expired_sending = 0, expired_receiving = 0;
+    {
+        std::lock_guard<std::mutex> lock(expired_mutex_);
+        for (const auto& [topic, counts] : expired_) {
+            expired_sending += counts[kExpiredSending];
+            expired_receiving += counts[kExpiredReceiving];
+            expired_topics[topic] = {
+                {"sending", counts[kExpiredSending]},
+                {"receiving", counts[kExpiredReceiving]}
+            };
+        }
+    }
+    stats["expired"] = {
+        {"sending", expired_sending},
+        {"receiving", expired_receiving},
+        {"topics", expired_topics}
+    };
+
+    stats["topic_ids"] = {
+        {"interned_frames", interned_frames_.load()},
+        {"header_bytes_saved", interned_header_bytes_saved_.load()}
+    };
+
+    auto m = membership_.read();
+    std::vector<std::string> own_topics(m->self.exact.begin(), m->self.exact.end());
+    stats["topic_summary"] = {
+        {"enabled", config_.topic_summary},
+        {"filter_matches", summary_filter_matches_.load()},
+        {"false_positives", summary_false_positives_.load()},
+        {"exact_fetches", summary_topic_fetches_.load()},
+        {"bytes_saved", summary_bytes_saved_.load()},
+        {"own_false_positive_rate", TopicFilter(own_topics).false_positive_rate(own_topics.size())}
+    };
+    return stats.dump(4);
 }
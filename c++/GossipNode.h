@@ -1,21 +1,224 @@
 #pragma once
 
+#include <array>
 #include <string>
 #include <map>
+#include <memory>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
 #include <functional>
+#include <type_traits>
+#include <future>
 #include <netinet/in.h>
 #include "json.hpp"
+#include "TopicFilter.h"
+#include "TopicTrie.h"
+#include "Rcu.h"
+#include "IoEngine.h"
+#include "Metrics.h"
+#include "SubscriptionRegistry.h"
+#include "MpscQueue.h"
+#include "Threads.h"
+#include "DispatchPool.h"
+#include "TopicQueue.h"
+#include "TopicHistory.h"
+#include "RateLimiter.h"
+#include "TopicLog.h"
+#include "TimeSeries.h"
+
+// What a publisher does with a message for a peer that has run out of credits
+enum class FlowPolicy {
+    Queue,     // Hold it until credits arrive; the publisher blocks while credit_queue_limit are held
+               // (the sender thread, which must not block, drops the oldest instead)
+    Conflate,  // Hold only the latest message per topic
+    Drop       // Discard it
+};
+
+// A token-bucket rate limit; zero rates are unlimited. The policy says what
+// happens to a message over the limit: Queue delays it (the publisher waits
+// for tokens), Drop discards it, Conflate keeps only the newest message per
+// topic and conflation key until tokens arrive.
+struct RateLimit {
+    double messages_per_second = 0;
+    double bytes_per_second = 0;   // Content bytes
+    double burst_seconds = 1.0;    // Traffic a full bucket lets through at once
+    FlowPolicy policy = FlowPolicy::Queue;
+};
+
+// Traffic classes, highest first. Control is the node's own membership
+// traffic; topics are Normal unless GossipConfig::topic_priorities says
+// otherwise. Each data class gets its own connection to a peer, and sockets
+// carry a matching SO_PRIORITY for the kernel's queueing disciplines.
+enum class Priority {
+    Control,
+    High,
+    Normal,
+    Bulk
+};
+
+struct GossipConfig {
+    // Gossip a Bloom filter of our topics instead of the subscribed_topics
+    // array whenever it is smaller. Peers fetch the exact list lazily once the
+    // filter matches a topic they publish.
+    bool topic_summary = false;
+
+    // Number of SO_REUSEPORT listening sockets on the port. Each gets its own
+    // accept thread; with more than one and no io_threads CPUs set, listener i
+    // and the handler threads it spawns are pinned to CPU i (mod the number of
+    // CPUs).
+    int listeners = 1;
+
+    // listen() backlog per listening socket
+    int listen_backlog = 5;
+
+    // Peers queried concurrently per membership refresh round (once a second)
+    int gossip_fanout = 3;
+
+    // Acknowledged messages in flight per peer; publish_acked() blocks while
+    // a peer has this many unacknowledged
+    int ack_window = 64;
+
+    // Subscriber callbacks run on a work-stealing pool of this many threads
+    // instead of the connection handler threads: in order per topic, in
+    // parallel across topics. 0 runs them on the handler threads. With the
+    // pool, acks confirm that a message was queued for its subscribers.
+    int dispatch_threads = 0;
+
+    // Messages waiting per topic before the connections feeding it block
+    int dispatch_queue_limit = 4096;
+
+    // Credit-based flow control with peers that support it. A receiver lets
+    // each inbound connection run credit_window messages ahead of the ones
+    // its subscribers have finished with; a publisher out of credits applies
+    // the first flow_policies pattern matching the topic, or
+    // default_flow_policy.
+    int credit_window = 256;
+    FlowPolicy default_flow_policy = FlowPolicy::Queue;
+    std::vector<std::pair<std::string, FlowPolicy>> flow_policies;
+    size_t credit_queue_limit = 4096;
+
+    // Topics (MQTT patterns) where only the newest value matters, such as
+    // camera frames or sensor state. A message not yet delivered is replaced
+    // by a newer one: in a publisher's credit queue (these topics default to
+    // FlowPolicy::Conflate) and, with dispatch_threads, in the receiver's
+    // dispatch queue, so a slow subscriber always gets the latest value.
+    // Peers with credits get them unsequenced, as a replaced message would
+    // otherwise count as lost.
+    std::vector<std::string> conflated_topics;
+
+    // Splits a conflated topic into independent values (e.g. one per sensor
+    // id found in the content). Unset, the topic is the only key.
+    std::function<std::string(const std::string& topic, const std::string& content)> conflation_key;
+
+    // Topic priorities (MQTT pattern, first match wins). High topics reach a
+    // peer on their own connection, so they never wait behind a large frame
+    // of a lower class, and the publish_queued() sender takes them first,
+    // even between the chunks of a large lower-class frame. Control is
+    // reserved for membership traffic and is treated as High here.
+    std::vector<std::pair<std::string, Priority>> topic_priorities;
+
+    // Rate limits on what this node sends to peers, checked before any frame
+    // is built. node_rate_limit covers all of it; every topic matching a
+    // topic_rate_limits pattern (first match wins) gets a bucket of its own;
+    // every peer gets a peer_rate_limit bucket unless peer_rate_limits has
+    // one for it ("ip:port"). Local subscribers are never limited, and
+    // publish_acked() messages are delayed rather than conflated. Under Queue
+    // the publisher waits for tokens, except the sender thread of
+    // publish_queued(): it parks the message and moves on. Once a topic has
+    // messages parked, later ones park behind them, so none overtakes another.
+    RateLimit node_rate_limit;
+    std::vector<std::pair<std::string, RateLimit>> topic_rate_limits;
+    RateLimit peer_rate_limit;
+    std::map<std::string, RateLimit> peer_rate_limits;
+
+    // Last-value cache: the newest message of each topic we publish, up to
+    // last_value_cache_bytes in all (least recently published topics are
+    // evicted first). A peer gets the cached value as soon as membership
+    // shows it subscribing, or when it calls request_last_values(), instead
+    // of waiting for the next publish. 0 disables the cache. With
+    // last_value_relay, values received from peers are cached and served too,
+    // unsequenced since they belong to another publisher. A value past its
+    // deadline is not served.
+    size_t last_value_cache_bytes = 0;
+    bool last_value_relay = false;
+
+    // History: the last history_depth messages of each topic we publish, by
+    // sequence number (messages over history_message_limit bytes are not
+    // kept). A subscriber whose stream skips ahead after its connection to
+    // us dropped asks for the sequence numbers it missed and gets those
+    // still in history, late and after the newer messages. 0 disables it.
+    size_t history_depth = 256;
+    size_t history_message_limit = 4096;
+
+    // Messages on topics matching compressed_topics go LZ-compressed (see
+    // Compression.h) to peers with the "lz" capability. Messages under
+    // compression_min_bytes, or whose sampled bytes look incompressible, or
+    // that shrink by less than an eighth are sent as they are. Every node
+    // can receive compressed messages.
+    std::vector<std::string> compressed_topics;
+    size_t compression_min_bytes = 512;
+
+    // publish_series() batches each topic's samples for series_window, or
+    // until series_max_points are waiting, into one block. Samples not yet
+    // sent when the node is destroyed are dropped.
+    std::chrono::milliseconds series_window{1000};
+    size_t series_max_points = 256;
+
+    // Record the topics this node publishes that match logged_topics, each
+    // in its own TopicLog under topic_log_dir (the topic escaped into one
+    // directory name; the empty topic is not logged). See TopicLog::Options
+    // for durability. publish() only queues a copy; a log writer thread
+    // appends it, so a record reaches the log shortly after publish()
+    // returns. Empty topic_log_dir disables logging.
+    std::string topic_log_dir;
+    std::vector<std::string> logged_topics = {"#"};
+    TopicLog::Options topic_log;
+
+    // Thread placement. I/O: accept threads, the publish_queued() sender and
+    // the I/O engine. Gossip: the membership refresh and repair threads.
+    // Callback: the connection handler threads that run subscriber callbacks
+    // (empty cpus inherits the accept thread's affinity). SCHED_FIFO needs
+    // CAP_SYS_NICE; without it the threads keep the default policy.
+    ThreadPlacement io_threads;
+    ThreadPlacement gossip_threads;
+    ThreadPlacement callback_threads;
+};
 
 class GossipNode {
 public:
-    GossipNode(const std::string& host = "127.0.0.1", int port = 5000);
+    GossipNode(const std::string& host = "127.0.0.1", int port = 5000, const GossipConfig& config = GossipConfig());
     ~GossipNode();
 
-    // Subscriptions
-    void subscribe(const std::string& topic, std::function<void(const std::string&, const std::string&)> callback);
+    // Subscriptions. Topics may be MQTT-style patterns such as "site/+/camera/#".
+    // Both may be called at any time, including from inside a callback.
+    using SubscriptionId = SubscriptionRegistry::Id;
+    SubscriptionId subscribe(const std::string& topic, std::function<void(const std::string&, const std::string&)> callback);
+    void unsubscribe(SubscriptionId id);
+
+    // Pull-based subscription: messages on the topic (or pattern) collect in a
+    // bounded queue that the caller drains with poll(), wait_for() or the
+    // queue's eventfd. The queue unsubscribes when destroyed.
+    std::unique_ptr<TopicQueue> open_queue(const std::string& topic, size_t capacity = 1024,
+                                           QueuePolicy policy = QueuePolicy::DropOldest);
+
+    // Asks the known nodes with a last-value cache for their cached values
+    // of the topic (or pattern); they arrive through the subscriptions like
+    // any other message. Blocks while it contacts the nodes.
+    void request_last_values(const std::string& topic);
+
+    // The log recording a topic published here, for replay; null unless
+    // topic_log_dir is set and the topic matches logged_topics
+    std::shared_ptr<TopicLog> topic_log(const std::string& topic);
 
     // Node registration
     void add_known_node(const std::string& ip, int port);
@@ -24,30 +227,607 @@ public:
     // Publish data to all interested nodes
     void publish(const std::string& topic, const std::string& content);
 
+    // Publish with a deadline, for data that is useless once late (control
+    // loops). The deadline travels in the frame to peers with the
+    // "deadlines" capability; wherever the message still waits when it
+    // passes (rate limits, credit queues, the receiver's dispatch queue) it
+    // is discarded and counted. Nodes compare deadlines against their wall
+    // clocks, so those should be synchronized.
+    void publish(const std::string& topic, const std::string& content, std::chrono::milliseconds ttl);
+    void publish_until(const std::string& topic, const std::string& content,
+                       std::chrono::system_clock::time_point deadline);
+
+    // Numeric series, for sensor feeds: samples are batched per topic and
+    // sent as one Gorilla-compressed block (see TimeSeries.h) instead of a
+    // message each. Blocks are ordinary messages on the topic, which
+    // subscribe_series() decodes into one callback per sample, in order. A
+    // block holds one value type; switching types closes the block.
+    void publish_series(const std::string& topic, double value,
+                        std::chrono::system_clock::time_point time = std::chrono::system_clock::now());
+    template <typename Integer, typename = std::enable_if_t<std::is_integral_v<Integer>>>
+    void publish_series(const std::string& topic, Integer value,
+                        std::chrono::system_clock::time_point time = std::chrono::system_clock::now()) {
+        add_series_point(topic, time, double(value), int64_t(value), true);
+    }
+    using SeriesCallback = std::function<void(const std::string& topic, const SeriesPoint& point)>;
+    SubscriptionId subscribe_series(const std::string& topic, SeriesCallback callback);
+
+    // Acknowledged publish. The result becomes true once every interested peer
+    // has delivered the message to its subscribers, false if a send fails or
+    // the timeout passes first. Acks are cumulative and pipelined, so they cost
+    // far less than one round trip per message. done runs on the I/O engine
+    // thread, or on the calling thread if the outcome is known right away; it
+    // must not call into the node there.
+    std::future<bool> publish_acked(const std::string& topic, const std::string& content,
+                                    std::chrono::milliseconds timeout = std::chrono::seconds(5));
+    void publish_acked(const std::string& topic, const std::string& content,
+                       std::chrono::milliseconds timeout, std::function<void(bool)> done);
+
+    // Queued publish for hot threads: the call only links the message into a
+    // lock-free queue, and the node's sender thread does the sends and the
+    // local delivery. Messages queued by one thread keep their order within
+    // a topic priority; higher priorities are sent first.
+    void publish_queued(std::string topic, std::string content);
+
+    // Messages queued together with a single atomic operation. A batch keeps
+    // its order and goes out with Normal priority.
+    class PublishBatch {
+    public:
+        void add(std::string topic, std::string content) {
+            chain_.push_back({std::move(topic), std::move(content)});
+        }
+        size_t size() const { return chain_.size(); }
+
+    private:
+        friend class GossipNode;
+        MpscQueue<std::pair<std::string, std::string>>::Chain chain_;
+    };
+    void publish_queued(PublishBatch&& batch);
+
+    // Opens the pooled connection to a peer on the I/O engine without
+    // blocking. done(connected) runs on the engine thread, or inline if the
+    // connection already exists. Coroutine wrappers live in GossipAsync.h.
+    void connect_async(const std::string& ip, int port, std::function<void(bool)> done);
+
     // Info for debugging
     std::string get_info_json() const;
 
+    // Counters for debugging (gossip bandwidth, repairs)
+    std::string get_stats_json() const;
+
 private:
     // Node identity
     std::string host_;
     int port_;
-    int server_fd_;
-    std::thread server_thread_;
+    GossipConfig config_;
+    struct Listener {
+        int fd = -1;
+        std::thread thread;
+        std::atomic<uint64_t> accepts{0};
+        std::atomic<uint64_t> backlog_full{0};  // accept queue seen at its limit
+        std::atomic<uint64_t> peak_queue{0};    // deepest accept queue seen
+    };
+    std::vector<std::unique_ptr<Listener>> listeners_;
+    std::chrono::steady_clock::time_point started_at_;
+    uint64_t listen_overflows_at_start_ = 0;
+    std::thread gossip_thread_;
+    std::thread repair_thread_;
+
+    // CPU time per thread role ("io", "gossip", "callback")
+    std::shared_ptr<ThreadStats> thread_stats_ = std::make_shared<ThreadStats>();
+
+    // Sockets of the running connection handler threads. They are detached;
+    // the destructor shuts these down and waits for the set to empty.
+    std::set<int> client_fds_;
+    std::mutex clients_mutex_;
+    std::condition_variable clients_cv_;
+    // Runs body on a new thread named name, placed and counted under role
+    std::thread start_thread(const std::string& role, const std::string& name,
+                             const ThreadPlacement& placement, std::function<void()> body);
+
+    // Runs the membership refresh queries and reads replies on outbound
+    // connections; never sends messages itself
+    std::unique_ptr<IoEngine> engine_;
+    void cancel_timer(uint64_t timer_id);
+
+    // Shutdown signalling for the background threads
+    std::atomic<bool> running_{true};
+    std::mutex stop_mutex_;
+    std::condition_variable stop_cv_;
+
+    // publish_queued() ingress, one queue per data priority (High, Normal,
+    // Bulk), drained by the sender thread. Producers only touch
+    // sender_mutex_ to wake the sender when it is asleep.
+    static constexpr size_t kDataLanes = 3;
+    std::array<MpscQueue<std::pair<std::string, std::string>>, kDataLanes> ingress_;
+    std::atomic<uint64_t> ingress_preemptions_{0};  // Large frames paused for higher lanes
 
-    // JSON info structure (self & known_nodes)
-    nlohmann::json info_;
+    struct Connection;
+    // Connections with held messages that credits or acks may have freed;
+    // flushed by the sender thread so the engine thread never sends
+    MpscQueue<std::shared_ptr<Connection>> flush_requests_;
+    std::thread sender_thread_;
+    std::atomic<bool> sender_sleeping_{false};
+    std::mutex sender_mutex_;
+    std::condition_variable sender_cv_;
+    std::atomic<uint64_t> ingress_sent_{0};
+    std::atomic<uint64_t> ingress_wakeups_{0};
+    std::atomic<uint64_t> ingress_largest_drain_{0};
 
-    // Local topic subscriptions
-    std::map<std::string, std::vector<std::function<void(const std::string&, const std::string&)>>> subscriptions_;
+    // One membership record: ourselves or a known peer
+    struct PeerRecord {
+        std::string ip;
+        int port = 0;
+        std::vector<std::string> topics;           // exact topics and patterns, in gossip order
+        std::unordered_set<std::string> exact;     // the exact ones, for routing
+        std::vector<std::string> patterns;         // the wildcard ones
+        TopicTrie<bool> pattern_trie;              // the same, for routing
+        std::vector<std::string> capabilities;
+        TopicFilter filter;                        // set if the peer gossips a summary
+        bool exact_fetched = false;                // topics holds the peer's full list
+        uint64_t topics_version = 0;               // of the list, bumped by its owner on every change
 
-    // Outbound connections
-    std::map<std::pair<std::string, int>, int> socket_pool_;
+        bool add_topic(const std::string& topic);
+        bool remove_topic(const std::string& topic);
+        void clear_topics();
+        bool has_capability(const std::string& capability) const;
+    };
+
+    // Membership (self & known_nodes) is published as immutable snapshots:
+    // publish() and the other readers never lock, gossip merges copy the
+    // current snapshot and swap in the modified copy.
+    struct Membership {
+        PeerRecord self;
+        std::vector<PeerRecord> known_nodes;
+
+        PeerRecord* find(const std::string& ip, int port);
+    };
+    RcuCell<Membership> membership_;
+
+    // Local topic subscriptions, keyed by topic or wildcard pattern
+    using Callback = SubscriptionRegistry::Callback;
+    using Callbacks = std::vector<std::shared_ptr<const Callback>>;
+    SubscriptionRegistry subscriptions_;
+
+    // Callback pool, one strand per topic; null when dispatch_threads is 0
+    std::unique_ptr<DispatchPool> dispatch_;
+
+    // One publish_acked() call, shared by the connections it went out on.
+    // Resolves to false if dropped unresolved (e.g. at shutdown).
+    struct PendingAck {
+        std::function<void(bool)> done;
+        std::atomic<int> remaining{1};  // Unacked peers, plus one while sending
+        std::atomic<bool> finished{false};
+        // Timeout timer, set on the engine thread; kTimerDone once complete
+        static constexpr uint64_t kTimerDone = UINT64_MAX;
+        std::atomic<uint64_t> timer{0};
+        GossipNode* node = nullptr;
+
+        void complete(bool delivered);
+        void release();  // One peer acked (or sending is done)
+        ~PendingAck() {
+            // Leaves the engine alone: it may be the one destroying us
+            if (!finished.exchange(true) && done) done(false);
+        }
+    };
+
+    // Replies on an outbound connection are matched to frames by order: the
+    // n-th reply answers the n-th frame that asked for one.
+    struct ResponseChannel {
+        uint64_t expected = 0;
+        uint64_t received = 0;
+        std::deque<std::pair<uint64_t, std::shared_ptr<PendingAck>>> waiting;
+    };
+
+    // Message deadline; the epoch means none
+    using Expiry = std::chrono::system_clock::time_point;
+    static bool expired(Expiry expires) {
+        return expires != Expiry() && std::chrono::system_clock::now() >= expires;
+    }
+
+    // A message that has its sequence number but has not gone out yet
+    struct OutboundMessage {
+        std::string topic;
+        std::string content;
+        uint64_t seq;
+        std::shared_ptr<PendingAck> ack;
+        std::chrono::steady_clock::time_point held_since;
+        std::string key;  // Conflation key, set when held under FlowPolicy::Conflate
+        Expiry expires;
+        // Compressed content, shared by the copies for each peer; null if the
+        // topic is not compressed or compressing did not pay off
+        std::shared_ptr<const std::string> packed;
+    };
+
+    // Outbound connections. Topics are interned per connection: the first
+    // frame for a topic binds it to a small ID (Topic-Id header), later frames
+    // carry only the varint ID. send_mutex keeps binding and use in order.
+    // Topics past kMaxTopicIds go out as plain POSTs.
+    //
+    // The I/O engine reads the replies. Peers with the "acks" capability reply
+    // only to acked frames, with a cumulative "ACK n"; other peers (Python
+    // nodes included) answer every frame with an HTTP status line. Peers with
+    // "credits" also send "CREDIT n" grants.
+    struct Connection {
+        int fd;
+        std::pair<std::string, int> key;
+        std::mutex send_mutex;
+        std::unordered_map<std::string, uint32_t> topic_ids;
+
+        std::mutex ack_mutex;
+        std::condition_variable ack_cv;  // Signalled when acks free the window
+        ResponseChannel acks;
+        ResponseChannel replies;
+        std::string inbox;  // Engine thread only
+        std::atomic<bool> closed{false};
+        Priority lane = Priority::Normal;
+
+        // Peer capabilities, refreshed under send_mutex on every publish
+        bool sequenced = false;
+        bool peer_acks = false;
+        bool interning = false;
+        bool deadlines = false;
+        bool compression = false;
+
+        // Credit flow control, if the peer has the "credits" capability.
+        // Data frames sent and the cumulative limit granted by "CREDIT n";
+        // messages beyond it wait in held, in publish order.
+        bool credits = false;
+        uint64_t frames_sent = 0;
+        std::atomic<uint64_t> credit_limit{kInitialCredits};
+        std::deque<OutboundMessage> held;  // Under send_mutex
+        std::condition_variable held_cv;   // Signalled when credits arrive
+
+        ~Connection();
+    };
+    // Credits a sender assumes before the receiver's first grant
+    static constexpr uint64_t kInitialCredits = 64;
+    // Topic IDs per connection; a receiver drops a peer that binds one beyond
+    static constexpr size_t kMaxTopicIds = 1 << 16;
+    // One connection per peer and data priority
+    using PoolKey = std::pair<std::pair<std::string, int>, Priority>;
+    std::map<PoolKey, std::shared_ptr<Connection>> socket_pool_;
+    std::array<std::atomic<uint64_t>, kDataLanes> lane_frames_{};
+    std::array<std::atomic<uint64_t>, kDataLanes> lane_bytes_{};
     std::mutex conn_mutex_;
 
+    // Server side of a connection, shared with callbacks still running on the
+    // dispatch pool; the socket closes with the last reference
+    struct InboundConnection {
+        int fd;
+        std::mutex send_mutex;  // Handler replies and credit grants from the pool
+        std::atomic<uint64_t> completed{0};  // Data frames whose callbacks have run
+        std::atomic<bool> credits{false};    // Peer sent "Credit: 1"
+        uint64_t granted = 0;                // Under send_mutex
+
+        void send(const std::string& data);
+        ~InboundConnection();
+    };
+
+    // Flow control metrics
+    std::atomic<uint64_t> credit_stalls_{0};      // Messages held for lack of credits
+    std::atomic<uint64_t> credit_dropped_{0};
+    std::atomic<uint64_t> credit_conflated_{0};
+    std::atomic<int64_t> credit_held_{0};         // Held across all connections now
+    std::atomic<uint64_t> credit_held_peak_{0};
+    std::atomic<uint64_t> credit_grants_{0};      // CREDIT lines sent to our publishers
+    LatencyHistogram credit_wait_;                // Time held messages waited for credits
+
+    // Rate limiting. Limiters are created on first use and never removed, so
+    // a RateLimiter* stays valid after rate_mutex_ is released.
+    enum RateScope { kNodeRate, kTopicRate, kPeerRate, kRateScopes };
+    struct RateBudget {
+        RateLimiter* limiter;
+        const RateLimit* limit;
+        RateScope scope;
+    };
+    struct RateCounters {
+        std::atomic<uint64_t> limited{0};    // Found the bucket empty
+        std::atomic<uint64_t> delayed{0};
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<uint64_t> conflated{0};  // Replaced while parked
+    };
+    bool rate_limited_ = false;  // Any limit configured
+    std::unique_ptr<RateLimiter> node_limiter_;
+    std::map<std::string, std::unique_ptr<RateLimiter>> topic_limiters_;
+    std::map<std::pair<std::string, int>, std::unique_ptr<RateLimiter>> peer_limiters_;
+    std::array<RateCounters, kRateScopes> rate_counters_;
+    LatencyHistogram rate_delay_;  // Time publishers waited for tokens
+
+    // Messages over a limit per (peer, topic, conflation key); port 0 stands
+    // for all peers. Conflate keeps the newest per key, Queue keeps them all
+    // in order under an empty key. An engine timer hands the key to the
+    // sender thread once the tokens should be there.
+    using ParkKey = std::tuple<std::pair<std::string, int>, std::string, std::string>;
+    struct Parked {
+        FlowPolicy policy;
+        RateScope scope;  // Of the limit that parked the first message
+        std::deque<OutboundMessage> messages;
+    };
+    std::map<ParkKey, Parked> parked_;
+    std::atomic<size_t> parked_messages_{0};
+    MpscQueue<ParkKey> unparked_;
+    mutable std::mutex rate_mutex_;
+
+    // Latest undelivered value of a conflated (topic, key). At most one
+    // dispatch task is queued per slot; it delivers whatever value is newest
+    // when it runs.
+    struct ConflationSlot {
+        std::mutex mutex;
+        bool pending = false;
+        std::string content;
+        Callbacks callbacks;
+        std::shared_ptr<InboundConnection> from;
+        Expiry expires;
+        uint64_t received = 0;
+        uint64_t conflated = 0;  // Replaced before delivery
+    };
+    std::map<std::pair<std::string, std::string>, std::shared_ptr<ConflationSlot>> conflation_slots_;
+    std::map<std::string, std::pair<uint64_t, uint64_t>> conflation_totals_;  // Received, conflated of swept slots
+    static constexpr size_t kConflationSweepMin = 1024;
+    size_t conflation_sweep_at_ = kConflationSweepMin;
+    void sweep_conflation_slots();
+    std::map<std::string, uint64_t> held_conflated_;  // Per topic, in publishers' credit queues
+    mutable std::mutex conflation_mutex_;
+
+    // Messages discarded past their deadline, per topic: on this node before
+    // sending, and on arrival or in the dispatch queue before delivery
+    enum ExpiryStage { kExpiredSending, kExpiredReceiving, kExpiryStages };
+    std::map<std::string, std::array<uint64_t, kExpiryStages>> expired_;
+    mutable std::mutex expired_mutex_;
+    void count_expired(const std::string& topic, ExpiryStage stage);
+
+    // Sequenced streams: each (publisher session, topic) pair numbers its
+    // messages from 1. A restarted publisher gets a new session. Receivers
+    // deliver a stream in order across connections, drop stale (duplicate or
+    // overtaken) messages and count skipped sequence numbers as lost.
+    std::string session_id_;
+    struct PublishStream {
+        uint64_t seq = 0;
+        std::unique_ptr<TopicHistory> history;  // Null if config_.history_depth is 0
+    };
+    std::unordered_map<std::string, PublishStream> publish_seqs_;
+    std::mutex publish_seqs_mutex_;  // Also serializes writes to the histories
+
+    struct InboundStream {
+        std::string publisher;
+        std::string topic;
+        std::mutex mutex;  // Held across delivery so a stream never reorders
+        // Written under mutex, read by get_stats_json() without it
+        std::atomic<uint64_t> last_seq{0};
+        std::atomic<uint64_t> delivered{0};
+        std::atomic<uint64_t> lost{0};
+        std::atomic<uint64_t> stale{0};
+        std::atomic<uint64_t> recovered{0};  // Lost, then resent from the publisher's history
+        std::set<uint64_t> missing;          // Sequence numbers asked for and not yet resent
+
+        // Caller holds mutex. With resend, a gap is recorded in missing and
+        // its range returned there so it can be asked for.
+        bool accept(uint64_t seq, std::pair<uint64_t, uint64_t>* resend = nullptr);
+    };
+    // Cap on InboundStream::missing, so a long outage cannot grow it unbounded
+    static constexpr size_t kMaxMissing = 1024;
+
+    std::map<std::pair<std::string, std::string>, std::shared_ptr<InboundStream>> inbound_streams_;
+    mutable std::mutex streams_mutex_;
+    std::shared_ptr<InboundStream> inbound_stream(const std::string& publisher, const std::string& topic);
+
+    // History resend requests, served by the sender thread
+    struct ResendRequest {
+        std::pair<std::string, int> peer;
+        std::string topic;
+        uint64_t from, to;
+    };
+    MpscQueue<ResendRequest> resend_requests_;
+    std::atomic<uint64_t> history_requests_{0};
+    std::atomic<uint64_t> history_resent_{0};
+    std::atomic<uint64_t> history_missed_{0};  // Asked for but already replaced
+    void serve_resend(const ResendRequest& request);
+
+    // Inbound side of topic interning, one flat table per connection
+    struct TopicSlot {
+        std::string topic;
+        Callbacks callbacks;
+        uint64_t version = ~0ULL; // subscriptions_.version() when resolved
+        std::shared_ptr<InboundStream> stream; // Set if the binding carried a session
+        DispatchPool::Strand* strand = nullptr; // Set when dispatch_ is
+    };
+    std::atomic<uint64_t> interned_frames_{0};
+    std::atomic<uint64_t> interned_header_bytes_saved_{0};
+
+    // Compression of outgoing messages (GossipConfig::compressed_topics) and
+    // decompression of incoming ones
+    std::shared_ptr<const std::string> pack(const std::string& content);
+    std::atomic<uint64_t> packed_messages_{0};
+    std::atomic<uint64_t> packed_bytes_in_{0};
+    std::atomic<uint64_t> packed_bytes_out_{0};
+    std::atomic<uint64_t> pack_skipped_small_{0};
+    std::atomic<uint64_t> pack_skipped_entropy_{0};
+    std::atomic<uint64_t> pack_skipped_ratio_{0};
+    std::atomic<uint64_t> unpacked_messages_{0};
+    std::atomic<uint64_t> unpack_errors_{0};
+    bool unpack(std::string& content);  // In place; false if malformed
+
+    // Time spent in publish(), for tail latency with and without gossip load
+    LatencyHistogram publish_latency_;
+
+    // From subscribe() to the subscription's first message
+    LatencyHistogram first_message_latency_;
+
+    // Last-value cache (GossipConfig::last_value_cache_bytes)
+    struct LastValue {
+        std::string content;
+        uint64_t seq;  // 0 for relayed values, which go out unsequenced
+        Expiry expires;
+        std::list<std::string>::iterator recent;
+    };
+    using PeerKey = std::pair<std::string, int>;
+    std::unordered_map<std::string, LastValue> last_values_;
+    std::list<std::string> last_value_order_;  // Most recently published first
+    size_t last_value_bytes_ = 0;
+    // Cached topics each peer wanted when last checked; a topic missing here
+    // that the peer now wants gets its value pushed
+    std::map<PeerKey, std::set<std::string>> last_value_served_;
+    mutable std::mutex last_values_mutex_;
+    std::atomic<bool> last_values_dirty_{false};  // Membership changed since the sender last checked
+    MpscQueue<std::pair<PeerKey, std::string>> last_value_requests_;  // (peer, topic pattern)
+    std::atomic<uint64_t> last_value_pushes_{0};
+    std::atomic<uint64_t> last_value_requests_served_{0};
+    std::atomic<uint64_t> last_value_evictions_{0};
+    void cache_last_value(const std::string& topic, const std::string& content, uint64_t seq, Expiry expires);
+
+    // Topic logs, opened on a topic's first publish; null for topics not logged
+    std::unordered_map<std::string, std::shared_ptr<TopicLog>> topic_logs_;
+    mutable std::mutex topic_logs_mutex_;
+    // Appends waiting for the log writer thread, which keeps page faults on
+    // fresh segment pages off the publishing threads
+    struct LogAppend {
+        std::shared_ptr<TopicLog> log;
+        std::string content;
+        std::chrono::system_clock::time_point time;
+    };
+    MpscQueue<LogAppend> log_appends_;
+    std::thread log_thread_;
+    std::atomic<bool> log_sleeping_{false};
+    std::mutex log_mutex_;
+    std::condition_variable log_cv_;
+    void write_logs();
+
+    // Numeric series being batched, one encoder per topic. Only the sender
+    // thread publishes blocks, so they go out in the order they closed.
+    struct Series {
+        SeriesEncoder encoder;
+        uint64_t window = 0;            // Counts closed blocks; a timer for an earlier one finds nothing to do
+        std::deque<std::string> ready;  // Closed blocks not yet published
+    };
+    std::unordered_map<std::string, Series> series_;
+    std::mutex series_mutex_;
+    MpscQueue<std::pair<std::string, uint64_t>> series_due_;  // (topic, window to close)
+    std::atomic<uint64_t> series_points_{0};
+    std::atomic<uint64_t> series_blocks_{0};
+    std::atomic<uint64_t> series_bytes_{0};
+    std::atomic<uint64_t> series_received_{0};
+    std::atomic<uint64_t> series_errors_{0};  // Messages on series subscriptions that were not blocks
+    void add_series_point(const std::string& topic, std::chrono::system_clock::time_point time, double value,
+                          int64_t integer, bool is_integer);
+    void send_series(const std::string& topic, uint64_t window);  // Sender thread
+
+    void membership_changed();
+    void push_last_values();                      // Sender thread
+    void serve_last_values(const PeerKey& peer, const std::string& pattern);  // Sender thread
+
+    // Gossip bandwidth accounting: full-state GET /info vs. digest repair
+    std::atomic<uint64_t> full_gossip_rounds_{0};
+    std::atomic<uint64_t> full_gossip_bytes_{0};
+    std::atomic<uint64_t> full_gossip_failures_{0};
+    std::atomic<uint64_t> digest_rounds_{0};
+    std::atomic<uint64_t> digest_bytes_{0};
+    std::atomic<uint64_t> digest_repaired_entries_{0};
+
+    // Peers whose topic filter matched before we had their exact list
+    std::set<std::pair<std::string, int>> pending_topic_fetches_;
+    std::mutex summary_mutex_;
+    std::atomic<uint64_t> summary_filter_matches_{0};
+    std::atomic<uint64_t> summary_false_positives_{0};
+    std::atomic<uint64_t> summary_topic_fetches_{0};
+    std::atomic<uint64_t> summary_bytes_saved_{0};
+
     // Server logic
     void bind_with_retry();
-    void start_server();
+    void start_server(Listener& listener);
     void handle_client(int client_fd);
-    void query_node_for_info(const std::string& ip, int port);
+    void deliver_local(const std::string& topic, const std::string& content,
+                       const std::shared_ptr<InboundConnection>& from = nullptr, Expiry expires = {});
+    void dispatch(DispatchPool::Strand* strand, const std::string& topic, std::string content, Callbacks callbacks,
+                  const std::shared_ptr<InboundConnection>& from, Expiry expires = {});
+    void frame_done(InboundConnection& client, uint64_t frames = 1);  // Returns credits
+    void query_node_for_info(const std::string& ip, int port);  // engine thread
+    using CorkedConnections = std::vector<std::shared_ptr<Connection>>;
+    void send_to_peers(const std::string& topic, const std::string& content,
+                       const std::shared_ptr<PendingAck>& ack, std::chrono::steady_clock::time_point deadline,
+                       CorkedConnections* corked = nullptr, size_t preempt_below = 0, Expiry expires = {});
+    // The network part of send_to_peers(), to every interested peer or only
+    // one; admitted means only's limits were charged already. A message with
+    // seq 0 goes out unsequenced.
+    void send_remote(const OutboundMessage& message, std::chrono::steady_clock::time_point deadline,
+                     CorkedConnections* corked, size_t preempt_below,
+                     const std::pair<std::string, int>* only = nullptr, bool admitted = false);
+    // Numbers a message as it leaves and keeps it for resends and the
+    // last-value cache
+    uint64_t next_seq(const std::string& topic, const std::string& content, Expiry expires);
+    // The buckets a message is charged to: node and topic without a peer,
+    // otherwise the peer's
+    std::vector<RateBudget> rate_budgets(const std::string& topic, const std::pair<std::string, int>* peer);
+    const RateLimit& peer_rate_limit(const std::pair<std::string, int>& peer) const;
+    bool peer_conflates(const std::pair<std::string, int>& peer) const;
+    static std::pair<std::chrono::nanoseconds, const RateBudget*> rate_wait(const std::vector<RateBudget>& budgets,
+                                                                             size_t bytes);
+    // Charges the message if it may go out now. Otherwise applies the
+    // binding limit's policy and returns false if it was dropped or parked.
+    bool admit(const OutboundMessage& message, const std::pair<std::string, int>* peer);
+    // Caller holds rate_mutex_
+    void park(const ParkKey& key, const OutboundMessage& message, FlowPolicy policy, RateScope scope,
+              std::chrono::nanoseconds wait);
+    void schedule_unpark(const ParkKey& key, std::chrono::nanoseconds wait);
+    void unpark(const ParkKey& key);  // Sender thread
+    void watch_connection(const std::shared_ptr<Connection>& conn);
+    // Caller holds conn.send_mutex. false if the ack window stayed full until
+    // the deadline or the connection closed; throws on a failed send.
+    // Frames larger than kChunkSize are written in chunks; with preempt_below,
+    // queued messages of the lanes above are sent between chunks.
+    static constexpr size_t kChunkSize = 64 * 1024;
+    bool send_frame(Connection& conn, const OutboundMessage& message, std::chrono::steady_clock::time_point deadline,
+                    size_t preempt_below = 0);
+    void hold(Connection& conn, OutboundMessage message, std::unique_lock<std::mutex>& send_lock);
+    void flush_held(Connection& conn);                     // Caller holds conn.send_mutex
+    void expire_held(Connection& conn);                    // Caller holds conn.send_mutex
+    void request_flush(const std::shared_ptr<Connection>& conn);
+    // A GossipConfig pattern list, compiled once. Each pattern maps to its
+    // position in the list; the lowest matching one wins, as in a scan.
+    struct PatternIndex {
+        static constexpr size_t npos = ~size_t(0);
+        TopicTrie<size_t> trie;
+
+        void add(const std::string& pattern, size_t position);
+        size_t first_match(const std::string& topic) const;  // npos if none
+        bool any_match(const std::string& topic) const { return first_match(topic) != npos; }
+    };
+    PatternIndex priority_patterns_;   // topic_priorities
+    PatternIndex flow_patterns_;       // flow_policies
+    PatternIndex conflated_patterns_;  // conflated_topics
+    PatternIndex compressed_patterns_; // compressed_topics
+    PatternIndex rate_patterns_;       // topic_rate_limits
+    PatternIndex logged_patterns_;     // logged_topics
+    void index_patterns();
+
+    Priority topic_priority(const std::string& topic) const;
+    static size_t lane_of(Priority priority);
+    FlowPolicy flow_policy(const std::string& topic) const;
+    bool is_conflated(const std::string& topic) const;
+    bool is_compressed(const std::string& topic) const;
+    std::string conflation_key(const std::string& topic, const std::string& content) const;
+    void conflate(DispatchPool::Strand* strand, const std::string& topic, std::string content, Callbacks callbacks,
+                  const std::shared_ptr<InboundConnection>& from, Expiry expires);
+    void drain_ingress();
+    uint64_t drain_lanes(size_t lanes, CorkedConnections* corked);  // Lanes [0, lanes), highest first
+    bool has_ingress(size_t lanes);
+    static void uncork(CorkedConnections& corked);
+    void wake_sender();
+    void drop_connection(const std::shared_ptr<Connection>& conn);
+    void fail_pending(Connection& conn);
+    void merge_known_nodes(const std::vector<nlohmann::json>& records);
+
+    // Wire form of the membership: peer records carry topic filters where
+    // available, and capabilities unless the reader would not understand them
+    nlohmann::json gossip_info(bool count_savings = false, bool capabilities = true);
+    static nlohmann::json record_json(const PeerRecord& node);
+    bool node_wants_topic(const PeerRecord& node, const std::string& topic);
+    void fetch_exact_topics(const std::string& ip, int port);
     void update_known_nodes_periodically();
+    bool wait_for_stop(std::chrono::milliseconds timeout);
+
+    // Anti-entropy: Merkle digest over the membership table
+    void repair_membership_periodically();
+    void repair_membership_with(const std::string& ip, int port);
+    std::string handle_digest_request(const std::string& payload);
 };
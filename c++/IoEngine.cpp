@@ -0,0 +1,139 @@
+#include "IoEngine.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <iostream>
+
+IoEngine::IoEngine(ThreadMain thread_main) {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+
+    thread_ = std::thread([this, thread_main = std::move(thread_main)] {
+        if (thread_main) {
+            thread_main([this] { run(); });
+        } else {
+            run();
+        }
+    });
+}
+
+IoEngine::~IoEngine() {
+    stop();
+
+    // Whatever is still registered belongs to us now; handlers own their fds
+    handlers_.clear();
+    close(wake_fd_);
+    close(epoll_fd_);
+}
+
+void IoEngine::stop() {
+    running_ = false;
+    uint64_t one = 1;
+    write(wake_fd_, &one, sizeof(one));
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void IoEngine::post(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(post_mutex_);
+        posted_.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    write(wake_fd_, &one, sizeof(one));
+}
+
+void IoEngine::add(int fd, uint32_t events, Handler handler) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        std::cerr << "epoll_ctl ADD failed for fd " << fd << "\n";
+        return;
+    }
+    handlers_[fd] = std::make_shared<Handler>(std::move(handler));
+}
+
+void IoEngine::modify(int fd, uint32_t events) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void IoEngine::remove(int fd) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    handlers_.erase(fd);
+}
+
+uint64_t IoEngine::run_after(std::chrono::milliseconds delay, Task task) {
+    uint64_t id = ++next_timer_id_;
+    auto it = timers_.emplace(std::chrono::steady_clock::now() + delay, std::make_pair(id, std::move(task)));
+    timer_index_.emplace(id, it);
+    return id;
+}
+
+void IoEngine::cancel(uint64_t timer_id) {
+    auto it = timer_index_.find(timer_id);
+    if (it != timer_index_.end()) {
+        timers_.erase(it->second);
+        timer_index_.erase(it);
+    }
+}
+
+void IoEngine::run() {
+    epoll_event events[64];
+    while (running_) {
+        int timeout_ms = -1;
+        if (!timers_.empty()) {
+            auto wait = timers_.begin()->first - std::chrono::steady_clock::now();
+            timeout_ms = std::max<long>(0, std::chrono::ceil<std::chrono::milliseconds>(wait).count());
+        }
+
+        int n = epoll_wait(epoll_fd_, events, 64, timeout_ms);
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd_) {
+                uint64_t count;
+                read(wake_fd_, &count, sizeof(count));
+                continue;
+            }
+            auto it = handlers_.find(fd);
+            if (it == handlers_.end()) {
+                continue;
+            }
+            auto handler = it->second; // may remove itself while running
+            (*handler)(events[i].events);
+        }
+
+        run_posted();
+        run_due_timers();
+    }
+}
+
+void IoEngine::run_posted() {
+    std::vector<Task> tasks;
+    {
+        std::lock_guard<std::mutex> lock(post_mutex_);
+        tasks.swap(posted_);
+    }
+    for (auto& task : tasks) {
+        task();
+    }
+}
+
+void IoEngine::run_due_timers() {
+    auto now = std::chrono::steady_clock::now();
+    while (!timers_.empty() && timers_.begin()->first <= now) {
+        Task task = std::move(timers_.begin()->second.second);
+        timer_index_.erase(timers_.begin()->second.first);
+        timers_.erase(timers_.begin());
+        task();
+    }
+}
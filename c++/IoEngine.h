@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Single-threaded epoll reactor. File descriptors, handlers and timers are
+// owned by the engine thread; other threads hand work over with post().
+class IoEngine {
+public:
+    using Task = std::function<void()>;
+    using Handler = std::function<void(uint32_t events)>;
+    // Wraps the engine thread's loop, e.g. to name and place the thread
+    using ThreadMain = std::function<void(const std::function<void()>& loop)>;
+
+    explicit IoEngine(ThreadMain thread_main = {});
+    ~IoEngine();
+
+    // Ends the engine thread; handlers and timers still registered never run
+    // again. Lets an owner keep its pointer valid while the thread finishes.
+    void stop();
+
+    IoEngine(const IoEngine&) = delete;
+    IoEngine& operator=(const IoEngine&) = delete;
+
+    // Runs the task on the engine thread. Safe from any thread.
+    void post(Task task);
+
+    // Engine thread only
+    void add(int fd, uint32_t events, Handler handler);
+    void modify(int fd, uint32_t events);
+    void remove(int fd);
+    uint64_t run_after(std::chrono::milliseconds delay, Task task);
+    void cancel(uint64_t timer_id);
+
+    bool in_engine_thread() const { return std::this_thread::get_id() == thread_.get_id(); }
+
+private:
+    int epoll_fd_;
+    int wake_fd_;  // eventfd that interrupts epoll_wait for posted tasks
+    std::atomic<bool> running_{true};
+    std::thread thread_;
+
+    std::mutex post_mutex_;
+    std::vector<Task> posted_;
+
+    std::unordered_map<int, std::shared_ptr<Handler>> handlers_;
+    using Timers = std::multimap<std::chrono::steady_clock::time_point, std::pair<uint64_t, Task>>;
+    Timers timers_;
+    std::unordered_map<uint64_t, Timers::iterator> timer_index_;  // By id, for cancel()
+    uint64_t next_timer_id_ = 0;
+
+    void run();
+    void run_posted();
+    void run_due_timers();
+};
@@ -0,0 +1,64 @@
+#include "Metrics.h"
+
+int LatencyHistogram::bucket_of(uint64_t ns) {
+    if (ns < (1u << kSubBits)) {
+        return int(ns);
+    }
+    int log2 = 63 - __builtin_clzll(ns);
+    int sub = int((ns >> (log2 - kSubBits)) & ((1 << kSubBits) - 1));
+    return ((log2 - kSubBits + 1) << kSubBits) + sub;
+}
+
+uint64_t LatencyHistogram::upper_bound(int bucket) {
+    if (bucket < (1 << kSubBits)) {
+        return bucket;
+    }
+    int log2 = (bucket >> kSubBits) + kSubBits - 1;
+    uint64_t sub = bucket & ((1 << kSubBits) - 1);
+    return ((uint64_t(1) << kSubBits | sub) + 1) << (log2 - kSubBits);
+}
+
+void LatencyHistogram::record(std::chrono::nanoseconds latency) {
+    uint64_t ns = latency.count() > 0 ? uint64_t(latency.count()) : 0;
+    buckets_[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max = max_ns_.load(std::memory_order_relaxed);
+    while (ns > max && !max_ns_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::count() const {
+    uint64_t total = 0;
+    for (const auto& bucket : buckets_) {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+std::chrono::nanoseconds LatencyHistogram::percentile(double p) const {
+    uint64_t total = count();
+    if (total == 0) {
+        return std::chrono::nanoseconds(0);
+    }
+    uint64_t rank = uint64_t(p * total);
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            return std::chrono::nanoseconds(std::min(upper_bound(i), max_ns_.load()));
+        }
+    }
+    return std::chrono::nanoseconds(max_ns_.load());
+}
+
+nlohmann::json LatencyHistogram::to_json() const {
+    auto us = [](std::chrono::nanoseconds ns) { return ns.count() / 1000.0; };
+    return {
+        {"count", count()},
+        {"p50_us", us(percentile(0.5))},
+        {"p90_us", us(percentile(0.9))},
+        {"p99_us", us(percentile(0.99))},
+        {"p999_us", us(percentile(0.999))},
+        {"max_us", max_ns_.load() / 1000.0}
+    };
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "json.hpp"
+
+// Lock-free latency histogram: log2 buckets with 4 linear sub-buckets each,
+// so reported percentiles are within 25% of the true value.
+class LatencyHistogram {
+public:
+    void record(std::chrono::nanoseconds latency);
+
+    uint64_t count() const;
+    std::chrono::nanoseconds percentile(double p) const;
+
+    // {"count", "p50_us", "p90_us", "p99_us", "p999_us", "max_us"}
+    nlohmann::json to_json() const;
+
+private:
+    static constexpr int kSubBits = 2;
+    static constexpr int kBuckets = 64 << kSubBits;
+
+    std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+    std::atomic<uint64_t> max_ns_{0};
+
+    static int bucket_of(uint64_t ns);
+    static uint64_t upper_bound(int bucket);
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Unbounded multi-producer, single-consumer queue (Vyukov's node-based
+// design). A push is one atomic exchange plus a store, no matter how many
+// threads push at once; producers never wait for each other or for the
+// consumer. Values pushed by one thread are popped in that thread's order.
+template <typename T>
+class MpscQueue {
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        T value;
+    };
+
+public:
+    // Values linked up by one producer and pushed with a single exchange
+    class Chain {
+    public:
+        Chain() = default;
+        Chain(Chain&& other) noexcept
+            : first_(std::exchange(other.first_, nullptr)), last_(std::exchange(other.last_, nullptr)),
+              size_(std::exchange(other.size_, 0)) {}
+        Chain(const Chain&) = delete;
+        Chain& operator=(const Chain&) = delete;
+        ~Chain() {
+            while (first_) {
+                Node* next = first_->next.load(std::memory_order_relaxed);
+                delete first_;
+                first_ = next;
+            }
+        }
+
+        void push_back(T value) {
+            Node* node = new Node;
+            node->value = std::move(value);
+            if (last_) {
+                last_->next.store(node, std::memory_order_relaxed);
+            } else {
+                first_ = node;
+            }
+            last_ = node;
+            ++size_;
+        }
+
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+
+    private:
+        friend class MpscQueue;
+        Node* first_ = nullptr;
+        Node* last_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    MpscQueue() : head_(new Node), tail_(head_.load()) {}
+    ~MpscQueue() {
+        T value;
+        while (pop(value)) {}
+        delete tail_;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value) {
+        Node* node = new Node;
+        node->value = std::move(value);
+        link(node, node);
+    }
+
+    void push(Chain&& chain) {
+        if (chain.empty()) return;
+        link(chain.first_, chain.last_);
+        chain.first_ = chain.last_ = nullptr;
+        chain.size_ = 0;
+    }
+
+    // Consumer only. Returns false when empty, or when the next value's
+    // producer is between its exchange and its link; that value shows up on a
+    // later pop.
+    bool pop(T& value) {
+        Node* next = tail_->next.load(std::memory_order_acquire);
+        if (!next) return false;
+        value = std::move(next->value);
+        delete tail_;
+        tail_ = next;  // Becomes the new dummy node
+        return true;
+    }
+
+    // Consumer only
+    bool empty() const { return tail_->next.load(std::memory_order_seq_cst) == nullptr; }
+
+private:
+    std::atomic<Node*> head_;  // Last node pushed; shared by producers
+    Node* tail_;               // Dummy node before the next value; consumer only
+
+    void link(Node* first, Node* last) {
+        Node* prev = head_.exchange(last, std::memory_order_acq_rel);
+        prev->next.store(first, std::memory_order_seq_cst);
+    }
+};
@@ -0,0 +1,42 @@
+#include "RateLimiter.h"
+#include <algorithm>
+#include <cmath>
+
+RateLimiter::RateLimiter(double messages_per_second, double bytes_per_second, double burst_seconds)
+    : refilled_(std::chrono::steady_clock::now()) {
+    burst_seconds = std::max(burst_seconds, 0.0);
+    for (auto [bucket, rate] : {std::pair{&messages_, messages_per_second}, std::pair{&bytes_, bytes_per_second}}) {
+        bucket->rate = std::max(rate, 0.0);
+        bucket->capacity = std::max(1.0, bucket->rate * burst_seconds);
+        bucket->tokens = bucket->capacity;
+    }
+}
+
+double RateLimiter::Bucket::shortfall(double n) const {
+    if (rate == 0) return 0;
+    double need = std::min(n, capacity);
+    return tokens >= need ? 0 : (need - tokens) / rate;
+}
+
+void RateLimiter::refill() {
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - refilled_).count();
+    refilled_ = now;
+    for (Bucket* bucket : {&messages_, &bytes_}) {
+        bucket->tokens = std::min(bucket->capacity, bucket->tokens + elapsed * bucket->rate);
+    }
+}
+
+std::chrono::nanoseconds RateLimiter::wait(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    refill();
+    double seconds = std::max(messages_.shortfall(1), bytes_.shortfall(double(bytes)));
+    return std::chrono::nanoseconds(int64_t(std::ceil(seconds * 1e9)));
+}
+
+void RateLimiter::take(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    refill();
+    if (messages_.rate > 0) messages_.tokens -= 1;
+    if (bytes_.rate > 0) bytes_.tokens -= double(bytes);
+}
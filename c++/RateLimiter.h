@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+// Token buckets for a message rate and a byte rate, refilled continuously
+// and holding up to burst_seconds of traffic. A zero rate is unlimited.
+// wait() and take() are separate so a message can be checked against several
+// limiters before any of them is charged; concurrent callers may overshoot
+// by the messages that pass between the two.
+class RateLimiter {
+public:
+    RateLimiter(double messages_per_second, double bytes_per_second, double burst_seconds = 1.0);
+
+    // Time until a message of this size fits; zero if it fits now
+    std::chrono::nanoseconds wait(size_t bytes);
+
+    // Charges a message. A message larger than the byte burst passes once the
+    // bucket is full and leaves it in debt.
+    void take(size_t bytes);
+
+private:
+    struct Bucket {
+        double rate;      // Tokens per second; 0 is unlimited
+        double capacity;
+        double tokens;
+
+        double shortfall(double n) const;  // Seconds until n tokens fit
+    };
+
+    std::mutex mutex_;
+    Bucket messages_;
+    Bucket bytes_;
+    std::chrono::steady_clock::time_point refilled_;
+
+    void refill();  // Caller holds mutex_
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+// RCU-style cell holding an immutable, reference-counted snapshot of T.
+//
+// Writers copy the current snapshot, modify the copy and swap it in under a
+// writer mutex. Readers never lock and never touch the shared reference
+// count on the fast path: each thread caches the snapshot it last saw per
+// cell and only reloads it when the cell's epoch has moved on. A Reader
+// pins the snapshot for its lifetime; nested reads of the same cell on the
+// same thread see that pinned snapshot.
+template <typename T>
+class RcuCell {
+public:
+    RcuCell() : RcuCell(std::make_shared<const T>()) {}
+    explicit RcuCell(std::shared_ptr<const T> initial)
+        : id_(next_id()), current_(std::move(initial)), epoch_(next_epoch()) {
+        Registry& registry = live();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.ids.insert(id_);
+    }
+    ~RcuCell() {
+        Registry& registry = live();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.ids.erase(id_);
+        registry.generation.fetch_add(1, std::memory_order_release);
+    }
+
+    RcuCell(const RcuCell&) = delete;
+    RcuCell& operator=(const RcuCell&) = delete;
+
+    class Reader {
+    public:
+        const T& operator*() const { return *static_cast<const T*>(entry_->snapshot.get()); }
+        const T* operator->() const { return static_cast<const T*>(entry_->snapshot.get()); }
+        ~Reader() { --entry_->readers; }
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+    private:
+        friend class RcuCell;
+        explicit Reader(typename RcuCell::Entry* entry) : entry_(entry) { ++entry_->readers; }
+        typename RcuCell::Entry* entry_;
+    };
+
+    Reader read() const {
+        Cache& cache = thread_cache();
+        uint64_t generation = live().generation.load(std::memory_order_acquire);
+        if (cache.generation != generation) {
+            evict_destroyed(cache, generation);
+        }
+        Entry& entry = cache.entries[id_];
+        uint64_t epoch = epoch_.load(std::memory_order_acquire);
+        if (entry.epoch != epoch && entry.readers == 0) {
+            entry.snapshot = std::atomic_load(&current_);
+            entry.epoch = epoch;
+        }
+        return Reader(&entry);
+    }
+
+    // Shared copy of the current snapshot, for slow paths that keep it around
+    std::shared_ptr<const T> load() const {
+        return std::atomic_load(&current_);
+    }
+
+    // Runs mutate(T&) on a private copy and publishes it if mutate returns
+    // true. Writers are serialized; readers are never blocked.
+    template <typename Mutate>
+    bool update(Mutate&& mutate) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        auto copy = std::make_shared<T>(*current_);
+        if (!mutate(*copy)) {
+            return false;
+        }
+        std::atomic_store(&current_, std::shared_ptr<const T>(std::move(copy)));
+        epoch_.store(next_epoch(), std::memory_order_release);
+        return true;
+    }
+
+private:
+    struct Entry {
+        uint64_t epoch = 0;
+        std::shared_ptr<const void> snapshot;
+        int readers = 0;
+    };
+
+    // Per-thread snapshot cache, keyed by cell id. Epochs are unique across
+    // all cells, so a matching epoch always means the same snapshot.
+    struct Cache {
+        std::unordered_map<uint64_t, Entry> entries;
+        uint64_t generation = 0;  // Of the registry when last swept
+    };
+    static Cache& thread_cache() {
+        thread_local Cache cache;
+        return cache;
+    }
+
+    // Ids of the live cells. Destroying a cell bumps the generation, and
+    // each thread drops its snapshots of destroyed cells on its next read,
+    // so their last values do not live on until the thread exits. Never
+    // freed: cells with static storage may outlive any static here.
+    struct Registry {
+        std::mutex mutex;
+        std::unordered_set<uint64_t> ids;
+        std::atomic<uint64_t> generation{0};
+    };
+    static Registry& live() {
+        static Registry* registry = new Registry;
+        return *registry;
+    }
+    static void evict_destroyed(Cache& cache, uint64_t generation) {
+        Registry& registry = live();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (auto it = cache.entries.begin(); it != cache.entries.end();) {
+            if (it->second.readers == 0 && !registry.ids.count(it->first)) {
+                it = cache.entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        cache.generation = generation;
+    }
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> ids{0};
+        return ++ids;
+    }
+    static uint64_t next_epoch() {
+        static std::atomic<uint64_t> epochs{0};
+        return ++epochs;
+    }
+
+    const uint64_t id_;
+    std::shared_ptr<const T> current_;
+    std::atomic<uint64_t> epoch_;
+    std::mutex write_mutex_;
+};
@@ -0,0 +1,90 @@
+#include "SubscriptionRegistry.h"
+#include <algorithm>
+
+SubscriptionRegistry::Id SubscriptionRegistry::add(const std::string& topic, Callback callback) {
+    Subscription subscription{++next_id_, std::make_shared<const Callback>(std::move(callback))};
+
+    if (TopicTrie<int>::is_pattern(topic)) {
+        patterns_[pattern_shard_of(topic)].update([&](TopicTrie<Subscriptions>& trie) {
+            trie[topic].push_back(subscription);
+            return true;
+        });
+        ++pattern_count_;
+    } else {
+        shards_[shard_of(topic)].update([&](Shard& shard) {
+            shard[topic].push_back(subscription);
+            return true;
+        });
+    }
+    ++size_;
+    version_.fetch_add(1, std::memory_order_release);
+
+    // The id is only handed out once the subscription is visible, so remove()
+    // never races with the add of the same id.
+    std::lock_guard<std::mutex> lock(topics_mutex_);
+    topics_[subscription.id] = topic;
+    return subscription.id;
+}
+
+bool SubscriptionRegistry::remove(Id id, std::string& topic) {
+    {
+        std::lock_guard<std::mutex> lock(topics_mutex_);
+        auto it = topics_.find(id);
+        if (it == topics_.end()) {
+            return false;
+        }
+        topic = std::move(it->second);
+        topics_.erase(it);
+    }
+
+    auto drop = [id](Subscriptions& subscriptions) {
+        subscriptions.erase(std::remove_if(subscriptions.begin(), subscriptions.end(),
+                                           [id](const Subscription& s) { return s.id == id; }),
+                            subscriptions.end());
+        return subscriptions.empty();
+    };
+
+    if (TopicTrie<int>::is_pattern(topic)) {
+        patterns_[pattern_shard_of(topic)].update([&](TopicTrie<Subscriptions>& trie) {
+            if (drop(trie[topic])) trie.erase(topic);
+            return true;
+        });
+        --pattern_count_;
+    } else {
+        shards_[shard_of(topic)].update([&](Shard& shard) {
+            auto it = shard.find(topic);
+            if (it != shard.end() && drop(it->second)) shard.erase(it);
+            return true;
+        });
+    }
+    --size_;
+    version_.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+bool SubscriptionRegistry::contains(const std::string& topic) const {
+    if (TopicTrie<int>::is_pattern(topic)) {
+        return patterns_[pattern_shard_of(topic)].read()->find(topic) != nullptr;
+    }
+    auto shard = shards_[shard_of(topic)].read();
+    return shard->count(topic) > 0;
+}
+
+std::vector<std::shared_ptr<const SubscriptionRegistry::Callback>> SubscriptionRegistry::resolve(const std::string& topic) const {
+    std::vector<std::shared_ptr<const Callback>> callbacks;
+    {
+        auto shard = shards_[shard_of(topic)].read();
+        auto it = shard->find(topic);
+        if (it != shard->end()) {
+            for (const auto& subscription : it->second) callbacks.push_back(subscription.callback);
+        }
+    }
+    if (pattern_count_.load(std::memory_order_acquire) > 0) {
+        auto collect = [&callbacks](const Subscriptions& subscriptions) {
+            for (const auto& subscription : subscriptions) callbacks.push_back(subscription.callback);
+        };
+        patterns_[shard_of(first_level(topic))].read()->match(topic, collect);
+        patterns_[kShards].read()->match(topic, collect);
+    }
+    return callbacks;
+}
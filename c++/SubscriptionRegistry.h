@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Hash.h"
+#include "Rcu.h"
+#include "TopicTrie.h"
+
+// Local subscriptions that can change while messages are being dispatched.
+//
+// Exact topics are spread over kShards hash maps by topic hash. Wildcard
+// patterns go into kShards TopicTries by their first level, plus one trie for
+// patterns starting with a wildcard. Every shard is an RcuCell, so lookups on
+// the dispatch path take no locks and subscribe/unsubscribe copy only the
+// shard they touch. Callbacks are shared between snapshots.
+class SubscriptionRegistry {
+public:
+    using Callback = std::function<void(const std::string&, const std::string&)>;
+    using Id = uint64_t;
+
+    // Returns the id to pass to remove()
+    Id add(const std::string& topic, Callback callback);
+
+    // Removes one subscription and reports its topic. Returns false for
+    // unknown (or already removed) ids.
+    bool remove(Id id, std::string& topic);
+
+    // Whether any subscription for exactly this topic or pattern is left
+    bool contains(const std::string& topic) const;
+
+    // Calls visit(const Callback&) for every subscription matching the topic
+    template <typename Visitor>
+    void match(const std::string& topic, Visitor&& visit) const {
+        {
+            auto shard = shards_[shard_of(topic)].read();
+            auto it = shard->find(topic);
+            if (it != shard->end()) {
+                for (const auto& subscription : it->second) visit(*subscription.callback);
+            }
+        }
+        if (pattern_count_.load(std::memory_order_acquire) > 0) {
+            auto visit_all = [&visit](const Subscriptions& subscriptions) {
+                for (const auto& subscription : subscriptions) visit(*subscription.callback);
+            };
+            patterns_[shard_of(first_level(topic))].read()->match(topic, visit_all);
+            patterns_[kShards].read()->match(topic, visit_all);
+        }
+    }
+
+    // Matching callbacks, for callers that cache the result per topic
+    std::vector<std::shared_ptr<const Callback>> resolve(const std::string& topic) const;
+
+    // Bumped after every change. Load it before resolve(); a cache tagged with
+    // that value is current for as long as version() still returns it.
+    uint64_t version() const { return version_.load(std::memory_order_acquire); }
+
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t kShards = 64;
+
+    struct Subscription {
+        Id id;
+        std::shared_ptr<const Callback> callback;
+    };
+    using Subscriptions = std::vector<Subscription>;
+    using Shard = std::unordered_map<std::string, Subscriptions>;
+
+    std::array<RcuCell<Shard>, kShards> shards_;
+    std::array<RcuCell<TopicTrie<Subscriptions>>, kShards + 1> patterns_;  // last: leading wildcard
+    std::atomic<size_t> pattern_count_{0};
+
+    // Writer-side bookkeeping for remove()
+    std::unordered_map<Id, std::string> topics_;
+    std::mutex topics_mutex_;
+    std::atomic<Id> next_id_{0};
+
+    std::atomic<uint64_t> version_{0};
+    std::atomic<size_t> size_{0};
+
+    static size_t shard_of(const std::string& topic) { return mix(fnv1a(topic)) % kShards; }
+    static std::string first_level(const std::string& topic) { return topic.substr(0, topic.find('/')); }
+    static size_t pattern_shard_of(const std::string& pattern) {
+        std::string first = first_level(pattern);
+        return first == "+" || first == "#" ? kShards : shard_of(first);
+    }
+};
@@ -0,0 +1,82 @@
+#include "Threads.h"
+#include <pthread.h>
+#include <sched.h>
+#include <cstring>
+#include <iostream>
+
+using json = nlohmann::json;
+
+namespace {
+
+double cpu_ms(clockid_t clock) {
+    timespec ts{};
+    if (clock_gettime(clock, &ts) != 0) return 0;
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+} // namespace
+
+void place_current_thread(const std::string& name, const ThreadPlacement& placement) {
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+
+    if (!placement.cpus.empty()) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu : placement.cpus) {
+            CPU_SET(cpu, &cpus);
+        }
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (error != 0) {
+            std::cerr << "Could not pin " << name << ": " << strerror(error) << "\n";
+        }
+    }
+
+    if (placement.fifo_priority > 0) {
+        sched_param param{};
+        param.sched_priority = placement.fifo_priority;
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error != 0) {
+            std::cerr << "Could not make " << name << " SCHED_FIFO: " << strerror(error) << "\n";
+        }
+    }
+}
+
+ThreadStats::Scope::Scope(std::shared_ptr<ThreadStats> stats, const std::string& role) : stats_(std::move(stats)) {
+    clockid_t clock = CLOCK_THREAD_CPUTIME_ID;
+    pthread_getcpuclockid(pthread_self(), &clock);
+
+    std::lock_guard<std::mutex> lock(stats_->mutex_);
+    id_ = ++stats_->next_id_;
+    stats_->live_[id_] = LiveThread{role, clock};
+    stats_->roles_[role]; // List the role even before any thread exits
+}
+
+ThreadStats::Scope::~Scope() {
+    double used = cpu_ms(CLOCK_THREAD_CPUTIME_ID);
+
+    std::lock_guard<std::mutex> lock(stats_->mutex_);
+    auto it = stats_->live_.find(id_);
+    Role& role = stats_->roles_[it->second.role];
+    ++role.exited;
+    role.exited_cpu_ms += used;
+    stats_->live_.erase(it);
+}
+
+json ThreadStats::to_json() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    json stats = json::object();
+    for (const auto& [name, role] : roles_) {
+        stats[name] = {
+            {"live", 0},
+            {"exited", role.exited},
+            {"cpu_ms", role.exited_cpu_ms}
+        };
+    }
+    // Live threads cannot exit while we hold the mutex, so their clocks stay valid
+    for (const auto& [_, thread] : live_) {
+        json& role = stats[thread.role];
+        role["live"] = role["live"].get<int>() + 1;
+        role["cpu_ms"] = role["cpu_ms"].get<double>() + cpu_ms(thread.clock);
+    }
+    return stats;
+}
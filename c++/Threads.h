@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+// Where and how a group of node threads runs
+struct ThreadPlacement {
+    std::vector<int> cpus;  // CPUs the threads may run on; empty leaves affinity alone
+    int fifo_priority = 0;  // 1-99 runs the threads SCHED_FIFO (needs CAP_SYS_NICE)
+};
+
+// Names the calling thread (as shown by top -H and perf, at most 15
+// characters) and applies the placement. Failures are logged; the thread
+// keeps running with the default placement.
+void place_current_thread(const std::string& name, const ThreadPlacement& placement);
+
+// CPU time of a node's threads, grouped by role. Threads register for their
+// lifetime with a Scope; the time of threads that have exited stays counted.
+// Scopes share ownership, so a detached thread may finish after its node.
+class ThreadStats {
+public:
+    class Scope {
+    public:
+        Scope(std::shared_ptr<ThreadStats> stats, const std::string& role);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        std::shared_ptr<ThreadStats> stats_;
+        uint64_t id_;
+    };
+
+    // {role: {"live", "exited", "cpu_ms"}}
+    nlohmann::json to_json() const;
+
+private:
+    struct LiveThread {
+        std::string role;
+        clockid_t clock;
+    };
+    struct Role {
+        uint64_t exited = 0;
+        double exited_cpu_ms = 0;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<uint64_t, LiveThread> live_;
+    std::map<std::string, Role> roles_;
+    uint64_t next_id_ = 0;
+};
@@ -0,0 +1,293 @@
+#include "TimeSeries.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+int64_t to_ms(std::chrono::system_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+}
+
+std::chrono::system_clock::time_point from_ms(int64_t ms) {
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::milliseconds(ms)));
+}
+
+uint64_t double_bits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double bits_double(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+int64_t sign_extend(uint64_t value, int bits) {
+    return int64_t(value << (64 - bits)) >> (64 - bits);
+}
+
+// Delta-of-delta buckets after the "0", "10", "110", "1110" and "1111"
+// prefixes; a regular feed stays in the first one
+constexpr int kBucketBits[] = {0, 7, 9, 12, 64};
+
+// About 290 years either side of 1970, the range of system_clock in ns
+constexpr int64_t kMaxTimeMs = std::numeric_limits<int64_t>::max() / 1000000;
+
+void append_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += char((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+bool read_varint(const std::string& in, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        uint8_t byte = in[pos++];
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+class BitReader {
+public:
+    BitReader(const std::string& data, size_t pos) : data_(data), bit_(pos * 8) {}
+
+    size_t remaining() const { return data_.size() * 8 - bit_; }
+
+    bool read(int count, uint64_t& value) {
+        if (size_t(count) > remaining()) return false;
+        value = 0;
+        while (count > 0) {
+            int offset = bit_ % 8;
+            int n = std::min(count, 8 - offset);
+            uint8_t byte = data_[bit_ / 8];
+            value = value << n | ((byte >> (8 - offset - n)) & ((1u << n) - 1));
+            bit_ += n;
+            count -= n;
+        }
+        return true;
+    }
+
+    // Reads the bucket prefix and the signed delta-of-delta after it
+    bool read_delta_of_delta(int64_t& dod) {
+        int bucket = 0;
+        uint64_t bit;
+        while (bucket < 4) {
+            if (!read(1, bit)) return false;
+            if (!bit) break;
+            ++bucket;
+        }
+        if (bucket == 0) {
+            dod = 0;
+            return true;
+        }
+        uint64_t value;
+        if (!read(kBucketBits[bucket], value)) return false;
+        dod = sign_extend(value, kBucketBits[bucket]);
+        return true;
+    }
+
+private:
+    const std::string& data_;
+    size_t bit_;
+};
+
+}  // namespace
+
+void SeriesEncoder::add(std::chrono::system_clock::time_point time, double value) {
+    if (count_ > 0 && integers_) {
+        add(to_ms(time), uint64_t(std::llround(value)), true);
+    } else {
+        add(to_ms(time), double_bits(value), false);
+    }
+}
+
+void SeriesEncoder::add(std::chrono::system_clock::time_point time, int64_t value) {
+    if (count_ > 0 && !integers_) {
+        add(to_ms(time), double_bits(double(value)), false);
+    } else {
+        add(to_ms(time), uint64_t(value), true);
+    }
+}
+
+// Differences wrap around in uint64_t, so any sequence decodes exactly
+void SeriesEncoder::add(int64_t time_ms, uint64_t value, bool integer) {
+    if (count_++ == 0) {
+        integers_ = integer;
+        first_time_ = last_time_ = time_ms;
+        first_value_ = last_value_ = value;
+        last_delta_ = last_value_delta_ = 0;
+        last_leading_ = -1;
+        return;
+    }
+
+    int64_t delta = int64_t(uint64_t(time_ms) - uint64_t(last_time_));
+    add_delta_of_delta(int64_t(uint64_t(delta) - uint64_t(last_delta_)));
+    last_time_ = time_ms;
+    last_delta_ = delta;
+
+    if (integers_) {
+        int64_t value_delta = int64_t(value - last_value_);
+        add_delta_of_delta(int64_t(uint64_t(value_delta) - uint64_t(last_value_delta_)));
+        last_value_delta_ = value_delta;
+        last_value_ = value;
+        return;
+    }
+
+    uint64_t xored = value ^ last_value_;
+    last_value_ = value;
+    if (xored == 0) {
+        add_bits(0, 1);
+        return;
+    }
+    int leading = std::min(31, __builtin_clzll(xored));
+    int trailing = __builtin_ctzll(xored);
+    if (last_leading_ >= 0 && leading >= last_leading_ && trailing >= last_trailing_) {
+        // Fits in the previous value's window of meaningful bits
+        add_bits(0b10, 2);
+        add_bits(xored >> last_trailing_, 64 - last_leading_ - last_trailing_);
+    } else {
+        int length = 64 - leading - trailing;
+        add_bits(0b11, 2);
+        add_bits(leading, 5);
+        add_bits(length & 63, 6);  // 64 is stored as 0
+        add_bits(xored >> trailing, length);
+        last_leading_ = leading;
+        last_trailing_ = trailing;
+    }
+}
+
+void SeriesEncoder::add_delta_of_delta(int64_t dod) {
+    if (dod == 0) {
+        add_bits(0, 1);
+        return;
+    }
+    for (int bucket = 1; bucket < 4; ++bucket) {
+        int64_t limit = int64_t(1) << (kBucketBits[bucket] - 1);
+        if (dod >= -limit && dod < limit) {
+            add_bits((uint64_t(1) << (bucket + 1)) - 2, bucket + 1);  // bucket ones, then a zero
+            add_bits(uint64_t(dod), kBucketBits[bucket]);
+            return;
+        }
+    }
+    add_bits(0b1111, 4);
+    add_bits(uint64_t(dod), 64);
+}
+
+void SeriesEncoder::add_bits(uint64_t value, int count) {
+    if (count < 64) value &= (uint64_t(1) << count) - 1;
+    while (count > 0) {
+        if (free_bits_ == 0) {
+            bits_ += '\0';
+            free_bits_ = 8;
+        }
+        int n = std::min(count, free_bits_);
+        uint8_t chunk = (value >> (count - n)) & ((1u << n) - 1);
+        bits_.back() = char(uint8_t(bits_.back()) | chunk << (free_bits_ - n));
+        free_bits_ -= n;
+        count -= n;
+    }
+}
+
+std::string SeriesEncoder::finish() {
+    if (count_ == 0) return std::string();
+    std::string block = "GS";
+    block += integers_ ? 'i' : 'd';
+    append_varint(block, count_);
+    append_varint(block, uint64_t(first_time_));
+    for (int i = 0; i < 8; ++i) {
+        block += char(first_value_ >> (8 * i));
+    }
+    block += bits_;
+
+    count_ = 0;
+    bits_.clear();
+    free_bits_ = 0;
+    return block;
+}
+
+bool decode_series(const std::string& block, std::vector<SeriesPoint>& points) {
+    if (block.size() < 3 || block.compare(0, 2, "GS") != 0 || (block[2] != 'd' && block[2] != 'i')) {
+        return false;
+    }
+    bool integers = block[2] == 'i';
+    size_t pos = 3;
+    uint64_t count, first_time;
+    if (!read_varint(block, pos, count) || !read_varint(block, pos, first_time) || count == 0 ||
+        block.size() - pos < 8) {
+        return false;
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= uint64_t(uint8_t(block[pos + i])) << (8 * i);
+    }
+    pos += 8;
+
+    BitReader reader(block, pos);
+    if (count - 1 > reader.remaining() / 2) return false;  // Every later point takes 2 bits or more
+
+    // Times system_clock cannot represent only come from corrupt blocks
+    auto emit = [&](int64_t time_ms) {
+        if (std::abs(time_ms) > kMaxTimeMs) return false;
+        SeriesPoint point;
+        point.time = from_ms(time_ms);
+        point.is_integer = integers;
+        if (integers) {
+            point.integer = int64_t(value);
+            point.value = double(point.integer);
+        } else {
+            point.value = bits_double(value);
+        }
+        points.push_back(point);
+        return true;
+    };
+
+    size_t start = points.size();
+    int64_t time = int64_t(first_time), delta = 0, value_delta = 0;
+    int leading = 0, trailing = 0;
+    bool window = false;  // Set by the first value with its own window
+    for (uint64_t i = 1; emit(time) && i < count; ++i) {
+        int64_t dod;
+        if (!reader.read_delta_of_delta(dod)) break;
+        delta = int64_t(uint64_t(delta) + uint64_t(dod));
+        time = int64_t(uint64_t(time) + uint64_t(delta));
+
+        if (integers) {
+            if (!reader.read_delta_of_delta(dod)) break;
+            value_delta = int64_t(uint64_t(value_delta) + uint64_t(dod));
+            value += uint64_t(value_delta);
+        } else {
+            uint64_t control, bits;
+            if (!reader.read(1, control)) break;
+            if (control) {
+                if (!reader.read(1, control)) break;
+                if (control) {
+                    uint64_t length;
+                    if (!reader.read(5, bits) || !reader.read(6, length)) break;
+                    leading = int(bits);
+                    if (length == 0) length = 64;
+                    if (leading + int(length) > 64) break;
+                    trailing = 64 - leading - int(length);
+                    window = true;
+                } else if (!window) {
+                    break;
+                }
+                if (!reader.read(64 - leading - trailing, bits)) break;
+                value ^= bits << trailing;
+            }
+        }
+    }
+    if (points.size() - start != count) {
+        points.resize(start);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One sample of a numeric series
+struct SeriesPoint {
+    std::chrono::system_clock::time_point time;  // Millisecond resolution
+    double value;         // Also set for integer series
+    int64_t integer = 0;  // Exact value, for integer series
+    bool is_integer = false;
+};
+
+// Packs a window of samples into a block, Gorilla style (Pelkonen et al.,
+// VLDB 2015): timestamps as delta-of-delta in millisecond buckets, double
+// values as the XOR with their predecessor, integer values as
+// delta-of-delta like the timestamps. A regular feed costs one bit per
+// timestamp and a few bits per slowly changing value.
+//
+// Block: "GS", a type byte ('d' or 'i'), varint point count, varint first
+// timestamp (Unix ms), the first value's 64 bits, then the bit stream.
+class SeriesEncoder {
+public:
+    void add(std::chrono::system_clock::time_point time, double value);
+    void add(std::chrono::system_clock::time_point time, int64_t value);
+
+    size_t size() const { return count_; }
+    bool integers() const { return integers_; }
+
+    // Returns the block of the points added since the last finish() and
+    // starts a new one
+    std::string finish();
+
+private:
+    bool integers_ = false;
+    size_t count_ = 0;
+    int64_t first_time_ = 0;
+    uint64_t first_value_ = 0;
+    int64_t last_time_ = 0;
+    int64_t last_delta_ = 0;
+    uint64_t last_value_ = 0;
+    int64_t last_value_delta_ = 0;  // Integer series
+    int last_leading_ = -1;          // XOR window of the previous value; -1 before the first
+    int last_trailing_ = 0;
+
+    std::string bits_;
+    int free_bits_ = 0;  // Unused low bits in the last byte of bits_
+
+    void add_bits(uint64_t value, int count);
+    void add_delta_of_delta(int64_t dod);
+    void add(int64_t time_ms, uint64_t value, bool integer);
+};
+
+// Appends the points of a block to points; false if it is not a valid block
+bool decode_series(const std::string& block, std::vector<SeriesPoint>& points);
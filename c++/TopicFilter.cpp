@@ -0,0 +1,135 @@
+#include "TopicFilter.h"
+#include "Hash.h"
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+using json = nlohmann::json;
+
+namespace {
+
+const char* kBase64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+std::string base64_encode(const std::vector<uint64_t>& words) {
+    std::string bytes;
+    for (uint64_t w : words) {
+        for (int i = 0; i < 8; ++i) bytes += char((w >> (8 * i)) & 0xff);
+    }
+
+    std::string out;
+    for (size_t i = 0; i < bytes.size(); i += 3) {
+        uint32_t chunk = (uint8_t)bytes[i] << 16;
+        if (i + 1 < bytes.size()) chunk |= (uint8_t)bytes[i + 1] << 8;
+        if (i + 2 < bytes.size()) chunk |= (uint8_t)bytes[i + 2];
+        out += kBase64[(chunk >> 18) & 63];
+        out += kBase64[(chunk >> 12) & 63];
+        out += i + 1 < bytes.size() ? kBase64[(chunk >> 6) & 63] : '=';
+        out += i + 2 < bytes.size() ? kBase64[chunk & 63] : '=';
+    }
+    return out;
+}
+
+std::vector<uint64_t> base64_decode(const std::string& text, size_t num_words) {
+    std::string bytes;
+    uint32_t chunk = 0;
+    int bits = 0;
+    for (char c : text) {
+        if (c == '=') break;
+        const char* pos = strchr(kBase64, c);
+        if (!pos || !*pos) throw std::invalid_argument("bad base64 in topic filter");
+        chunk = (chunk << 6) | uint32_t(pos - kBase64);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            bytes += char((chunk >> bits) & 0xff);
+        }
+    }
+    if (bytes.size() != num_words * 8) throw std::invalid_argument("topic filter size mismatch");
+
+    std::vector<uint64_t> words(num_words, 0);
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        words[i / 8] |= uint64_t((uint8_t)bytes[i]) << (8 * (i % 8));
+    }
+    return words;
+}
+
+} // namespace
+
+TopicFilter::TopicFilter(const std::vector<std::string>& topics) {
+    // Next power of two >= 16 bits per topic, at least one word
+    num_bits_ = 64;
+    while (num_bits_ < topics.size() * 16) num_bits_ *= 2;
+    words_.assign(num_bits_ / 64, 0);
+    for (const auto& topic : topics) add(topic);
+}
+
+TopicFilter::TopicFilter(const json& j) {
+    num_bits_ = j.at("bits").get<size_t>();
+    num_hashes_ = j.at("hashes").get<int>();
+    if (num_bits_ == 0 || num_bits_ % 64 != 0 || num_hashes_ <= 0) {
+        throw std::invalid_argument("bad topic filter shape");
+    }
+    if (num_bits_ > kMaxBits || num_hashes_ > kMaxHashes) {
+        throw std::invalid_argument("topic filter too large");
+    }
+    const std::string& data = j.at("data").get_ref<const std::string&>();
+    if (data.size() > (num_bits_ / 8 + 2) / 3 * 4) {
+        throw std::invalid_argument("topic filter size mismatch");
+    }
+    words_ = base64_decode(data, num_bits_ / 64);
+}
+
+// Double hashing: probe i is h1 + i * h2 (Kirsch & Mitzenmacher)
+void TopicFilter::add(const std::string& topic) {
+    uint64_t h1 = fnv1a(topic);
+    uint64_t h2 = mix(h1) | 1;
+    for (int i = 0; i < num_hashes_; ++i) {
+        size_t bit = (h1 + i * h2) % num_bits_;
+        words_[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+bool TopicFilter::might_contain(const std::string& topic) const {
+    if (words_.empty()) return false;
+    uint64_t h1 = fnv1a(topic);
+    uint64_t h2 = mix(h1) | 1;
+    for (int i = 0; i < num_hashes_; ++i) {
+        size_t bit = (h1 + i * h2) % num_bits_;
+        if (!(words_[bit / 64] & (1ULL << (bit % 64)))) return false;
+    }
+    return true;
+}
+
+bool TopicFilter::merge(const TopicFilter& other) {
+    if (other.empty()) return false;
+    if (num_bits_ != other.num_bits_ || num_hashes_ != other.num_hashes_) {
+        if (other.num_bits_ < num_bits_) return false;
+        *this = other;
+        return true;
+    }
+    bool changed = false;
+    for (size_t i = 0; i < words_.size(); ++i) {
+        uint64_t merged = words_[i] | other.words_[i];
+        changed |= merged != words_[i];
+        words_[i] = merged;
+    }
+    return changed;
+}
+
+double TopicFilter::false_positive_rate(size_t topics) const {
+    if (num_bits_ == 0) return 0.0;
+    double fill = 1.0 - std::exp(-double(num_hashes_) * topics / num_bits_);
+    return std::pow(fill, num_hashes_);
+}
+
+json TopicFilter::to_json() const {
+    return {
+        {"bits", num_bits_},
+        {"hashes", num_hashes_},
+        {"data", base64_encode(words_)}
+    };
+}
+
+bool TopicFilter::operator==(const TopicFilter& other) const {
+    return num_bits_ == other.num_bits_ && num_hashes_ == other.num_hashes_ && words_ == other.words_;
+}
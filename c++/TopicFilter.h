@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "json.hpp"
+
+// Bloom filter over topic names. Gossiped in place of the full
+// subscribed_topics array when a node subscribes to many fine-grained topics.
+// Sized at 16-32 bits per topic with 8 probes, i.e. about 0.05% false
+// positives; a false positive only costs one message the receiver drops.
+class TopicFilter {
+public:
+    TopicFilter() = default;
+    explicit TopicFilter(const std::vector<std::string>& topics);
+    // {"bits", "hashes", "data"}; throws std::invalid_argument on a malformed
+    // filter or one larger than kMaxBits
+    explicit TopicFilter(const nlohmann::json& j);
+
+    bool might_contain(const std::string& topic) const;
+    bool empty() const { return words_.empty(); }
+
+    // OR in another filter of the same shape; otherwise keep the larger one.
+    // Returns true if this filter changed.
+    bool merge(const TopicFilter& other);
+
+    // Expected false-positive rate with the given number of inserted topics
+    double false_positive_rate(size_t topics) const;
+
+    nlohmann::json to_json() const;
+    bool operator==(const TopicFilter& other) const;
+
+private:
+    // Caps on a filter received from a peer: 4 MB, about a million topics
+    // at our sizing, and a probe count no sane filter exceeds
+    static constexpr size_t kMaxBits = size_t(32) << 20;
+    static constexpr int kMaxHashes = 32;
+
+    size_t num_bits_ = 0;
+    int num_hashes_ = 8;
+    std::vector<uint64_t> words_;
+
+    void add(const std::string& topic);
+};
@@ -0,0 +1,60 @@
+#include "TopicHistory.h"
+#include <algorithm>
+
+TopicHistory::TopicHistory(size_t depth) : slots_(std::max<size_t>(1, depth)) {
+    for (auto& slot : slots_) {
+        slot.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+TopicHistory::~TopicHistory() {
+    for (auto& slot : slots_) {
+        delete slot.load();
+    }
+    for (auto* list : {&retired_, &spare_}) {
+        for (Entry* entry : *list) {
+            delete entry;
+        }
+    }
+}
+
+// A reader registers before loading a slot, so once put() has swapped an
+// entry out and then sees no readers, no reader can still hold it.
+void TopicHistory::put(uint64_t seq, const std::string& content, std::chrono::system_clock::time_point expires) {
+    Entry* entry;
+    if (spare_.empty()) {
+        entry = new Entry{seq, content, expires};
+    } else {
+        entry = spare_.back();
+        spare_.pop_back();
+        entry->seq = seq;
+        entry->content.assign(content);
+        entry->expires = expires;
+    }
+    Entry* replaced = slots_[seq % slots_.size()].exchange(entry);
+    if (replaced) {
+        retired_.push_back(replaced);
+    }
+    if (readers_.load() == 0) {
+        for (Entry* retired : retired_) {
+            if (spare_.size() < kMaxSpare) {
+                spare_.push_back(retired);
+            } else {
+                delete retired;
+            }
+        }
+        retired_.clear();
+    }
+}
+
+bool TopicHistory::get(uint64_t seq, std::string& content, std::chrono::system_clock::time_point& expires) const {
+    ++readers_;
+    const Entry* entry = slots_[seq % slots_.size()].load();
+    bool found = entry && entry->seq == seq;
+    if (found) {
+        content = entry->content;
+        expires = entry->expires;
+    }
+    --readers_;
+    return found;
+}
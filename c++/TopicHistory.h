@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The last messages published on one topic, by sequence number: message seq
+// lives in slot seq % depth until a later one replaces it. Writers must be
+// serialized by the caller (GossipNode puts them under the lock that already
+// hands out the topic's sequence numbers); readers take no lock. A replaced
+// entry is freed by the next put() that finds no reader active, so readers
+// only ever delay reuse, never block a writer. Freed entries are reused, so
+// once the ring is full a put() copies into a buffer that is already there.
+class TopicHistory {
+public:
+    explicit TopicHistory(size_t depth);
+    ~TopicHistory();
+
+    TopicHistory(const TopicHistory&) = delete;
+    TopicHistory& operator=(const TopicHistory&) = delete;
+
+    // expires is the message's deadline; the epoch means none
+    void put(uint64_t seq, const std::string& content, std::chrono::system_clock::time_point expires = {});
+
+    // Copies message seq and its deadline out; false if it has been replaced
+    // or was never kept
+    bool get(uint64_t seq, std::string& content, std::chrono::system_clock::time_point& expires) const;
+
+    size_t depth() const { return slots_.size(); }
+
+private:
+    struct Entry {
+        uint64_t seq;
+        std::string content;
+        std::chrono::system_clock::time_point expires;
+    };
+
+    std::vector<std::atomic<Entry*>> slots_;
+    mutable std::atomic<int> readers_{0};
+    // Writer only: entries replaced while a reader may hold them, and
+    // entries free for reuse
+    std::vector<Entry*> retired_;
+    std::vector<Entry*> spare_;
+    static constexpr size_t kMaxSpare = 16;
+};
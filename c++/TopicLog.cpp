@@ -0,0 +1,381 @@
+#include "TopicLog.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+
+namespace {
+
+int64_t to_ns(std::chrono::system_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+// The length word publishes a record to readers
+uint32_t load_length(const char* at) {
+    return __atomic_load_n(reinterpret_cast<const uint32_t*>(at), __ATOMIC_ACQUIRE);
+}
+
+void store_length(char* at, uint32_t length) {
+    __atomic_store_n(reinterpret_cast<uint32_t*>(at), length, __ATOMIC_RELEASE);
+}
+
+std::string segment_name(uint64_t first_seq) {
+    char name[32];
+    snprintf(name, sizeof(name), "%020llu.log", static_cast<unsigned long long>(first_seq));
+    return name;
+}
+
+} // namespace
+
+TopicLog::Segment::~Segment() {
+    if (data) {
+        munmap(data, size);
+    }
+}
+
+TopicLog::TopicLog(const std::string& dir, const Options& options) : dir_(dir), options_(options) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!options_.read_only) {
+        std::error_code error;
+        fs::create_directories(dir_, error);
+        if (error) {
+            std::cerr << "Cannot create topic log " << dir_ << ": " << error.message() << "\n";
+        }
+    }
+    load_segments();
+    if (!options_.read_only) {
+        if (segments_.empty()) {
+            start_segment();
+        }
+        apply_retention();
+    }
+}
+
+TopicLog::~TopicLog() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!options_.read_only && !segments_.empty() &&
+        (options_.sync_on_seal || options_.sync_interval.count() > 0)) {
+        sync(*segments_.back());
+    }
+}
+
+size_t TopicLog::record_bytes(size_t content_size) {
+    return (sizeof(Header) + content_size + 7) & ~size_t(7);
+}
+
+std::shared_ptr<TopicLog::Segment> TopicLog::map_segment(const std::string& path, uint64_t first_seq,
+                                                         bool create) const {
+    int flags = options_.read_only ? O_RDONLY : O_RDWR | (create ? O_CREAT | O_TRUNC : 0);
+    int fd = open(path.c_str(), flags | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Cannot open topic log segment " << path << ": " << strerror(errno) << "\n";
+        return nullptr;
+    }
+    size_t size = options_.segment_bytes;
+    struct stat st;
+    if (create ? ftruncate(fd, size) != 0 : fstat(fd, &st) != 0) {
+        std::cerr << "Cannot size topic log segment " << path << ": " << strerror(errno) << "\n";
+        close(fd);
+        return nullptr;
+    }
+    if (!create) {
+        size = st.st_size;
+    }
+    int protection = options_.read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+    void* data = size ? mmap(nullptr, size, protection, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd); // The mapping keeps the file open
+    if (data == MAP_FAILED) {
+        std::cerr << "Cannot map topic log segment " << path << "\n";
+        return nullptr;
+    }
+
+    auto segment = std::make_shared<Segment>();
+    segment->path = path;
+    segment->first_seq = first_seq;
+    segment->data = static_cast<char*>(data);
+    segment->size = size;
+    return segment;
+}
+
+uint64_t TopicLog::recover(Segment& segment) {
+    uint64_t last = 0;
+    size_t offset = 0;
+    while (offset + sizeof(Header) <= segment.size) {
+        uint32_t length = load_length(segment.data + offset);
+        if (length == kSealed) {
+            segment.sealed = true;
+            break;
+        }
+        if (length < sizeof(Header) || offset + length > segment.size) {
+            break; // End of the records, or a torn one
+        }
+        Header header;
+        memcpy(&header, segment.data + offset, sizeof(header));
+        if ((header.seq - segment.first_seq) % kIndexInterval == 0) {
+            segment.index.push_back({header.seq, header.time_ns, offset});
+        }
+        segment.last_time_ns = header.time_ns;
+        last = header.seq;
+        offset += record_bytes(length - sizeof(Header));
+    }
+    segment.end = offset;
+    return last;
+}
+
+void TopicLog::load_segments() const {
+    std::vector<std::pair<uint64_t, std::string>> found;
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator(dir_, error)) {
+        if (entry.path().extension() != ".log") continue;
+        try {
+            found.emplace_back(std::stoull(entry.path().stem().string()), entry.path().string());
+        } catch (...) {
+            // Not one of ours
+        }
+    }
+    std::sort(found.begin(), found.end());
+
+    // Segments the writer has deleted since the last load
+    while (!segments_.empty() && !fs::exists(segments_.front()->path)) {
+        segments_.pop_front();
+    }
+    for (const auto& [first_seq, path] : found) {
+        if (!segments_.empty() && first_seq <= segments_.back()->first_seq) continue;
+        auto segment = map_segment(path, first_seq, false);
+        if (!segment) continue;
+        uint64_t last = recover(*segment);
+        next_seq_ = std::max(next_seq_, last ? last + 1 : first_seq);
+        segments_.push_back(std::move(segment));
+    }
+}
+
+void TopicLog::start_segment() {
+    auto segment = map_segment(dir_ + "/" + segment_name(next_seq_), next_seq_, true);
+    if (!segment) return;
+    segments_.push_back(std::move(segment));
+    if (options_.sync_on_seal || options_.sync_interval.count() > 0) {
+        // The new file's directory entry, so the segment is found after a reboot
+        int fd = open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+    }
+}
+
+// Flushes the pages written since the last sync, including the sealed mark
+void TopicLog::sync(Segment& segment) {
+    size_t page = size_t(sysconf(_SC_PAGESIZE));
+    size_t from = segment.synced & ~(page - 1);
+    size_t to = std::min(segment.size, segment.end + (segment.sealed ? sizeof(uint32_t) : 0));
+    if (to <= from) return;
+    if (msync(segment.data + from, to - from, MS_SYNC) != 0) {
+        std::cerr << "Cannot sync topic log segment " << segment.path << ": " << strerror(errno) << "\n";
+        return;
+    }
+    segment.synced = to;
+    ++syncs_;
+}
+
+// The segment being written is never deleted
+void TopicLog::apply_retention() {
+    int64_t oldest_kept = to_ns(std::chrono::system_clock::now() - options_.retention_age);
+    uint64_t bytes = 0;
+    for (const auto& segment : segments_) {
+        bytes += segment->size;
+    }
+    while (segments_.size() > 1) {
+        const Segment& oldest = *segments_.front();
+        bool too_big = options_.retention_bytes > 0 && bytes > options_.retention_bytes;
+        bool too_old = options_.retention_age.count() > 0 && oldest.last_time_ns < oldest_kept;
+        if (!too_big && !too_old) break;
+        unlink(oldest.path.c_str()); // Readers keep their mappings
+        bytes -= oldest.size;
+        segments_.pop_front();
+        ++dropped_segments_;
+    }
+}
+
+uint64_t TopicLog::append(const std::string& content, std::chrono::system_clock::time_point time) {
+    size_t bytes = record_bytes(content.size());
+    if (options_.read_only || bytes > options_.segment_bytes) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (segments_.empty() || segments_.back()->sealed || segments_.back()->end + bytes > segments_.back()->size) {
+        if (!segments_.empty() && !segments_.back()->sealed) {
+            Segment& full = *segments_.back();
+            if (full.end + sizeof(uint32_t) <= full.size) {
+                store_length(full.data + full.end, kSealed);
+            }
+            full.sealed = true;
+            if (options_.sync_on_seal || options_.sync_interval.count() > 0) {
+                sync(full);
+            }
+        }
+        start_segment();
+        apply_retention();
+        if (segments_.empty() || segments_.back()->sealed) {
+            return 0; // Could not start a segment; retried on the next append
+        }
+    }
+
+    Segment& segment = *segments_.back();
+    char* at = segment.data + segment.end;
+    Header header{0, 0, next_seq_, to_ns(time)};
+    memcpy(at + sizeof(uint32_t), reinterpret_cast<const char*>(&header) + sizeof(uint32_t),
+           sizeof(Header) - sizeof(uint32_t));
+    memcpy(at + sizeof(Header), content.data(), content.size());
+    store_length(at, uint32_t(sizeof(Header) + content.size()));
+
+    if ((next_seq_ - segment.first_seq) % kIndexInterval == 0) {
+        segment.index.push_back({next_seq_, header.time_ns, segment.end});
+        if (options_.retention_age.count() > 0) {
+            apply_retention();
+        }
+    }
+    segment.end += bytes;
+    segment.last_time_ns = header.time_ns;
+    ++appended_;
+    if (options_.sync_interval.count() > 0) {
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_sync_ >= options_.sync_interval) {
+            sync(segment);
+            last_sync_ = now;
+        }
+    }
+    return next_seq_++;
+}
+
+uint64_t TopicLog::first_seq() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return segments_.empty() ? next_seq_ : segments_.front()->first_seq;
+}
+
+uint64_t TopicLog::next_seq() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_seq_;
+}
+
+std::pair<std::shared_ptr<TopicLog::Segment>, size_t> TopicLog::seek(uint64_t from_seq) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (options_.read_only) {
+        load_segments();
+    }
+    if (segments_.empty()) {
+        return {nullptr, 0};
+    }
+    auto it = std::upper_bound(segments_.begin(), segments_.end(), from_seq,
+                               [](uint64_t seq, const auto& segment) { return seq < segment->first_seq; });
+    if (it == segments_.begin()) {
+        return {*it, 0}; // Older than what is retained
+    }
+    const auto& segment = *--it;
+    auto entry = std::upper_bound(segment->index.begin(), segment->index.end(), from_seq,
+                                  [](uint64_t seq, const IndexEntry& e) { return seq < e.seq; });
+    return {segment, entry == segment->index.begin() ? 0 : std::prev(entry)->offset};
+}
+
+std::shared_ptr<TopicLog::Segment> TopicLog::next_segment(const Segment& segment) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        for (const auto& next : segments_) {
+            if (next->first_seq > segment.first_seq) {
+                return next;
+            }
+        }
+        if (!options_.read_only) break;
+        load_segments();
+    }
+    return nullptr;
+}
+
+uint64_t TopicLog::seq_at(std::chrono::system_clock::time_point time) const {
+    int64_t time_ns = to_ns(time);
+    uint64_t from = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& segment : segments_) {
+            for (const auto& entry : segment->index) {
+                if (entry.time_ns >= time_ns) break;
+                from = entry.seq;
+            }
+        }
+    }
+    uint64_t found = 0;
+    replay(from, [&](const Record& record) {
+        if (record.time < time) return true;
+        found = record.seq;
+        return false;
+    });
+    return found ? found : next_seq();
+}
+
+uint64_t TopicLog::replay(uint64_t from_seq, const std::function<bool(const Record&)>& fn, Pace pace) const {
+    auto [segment, offset] = seek(from_seq);
+    uint64_t count = 0;
+    auto started = std::chrono::steady_clock::now();
+    int64_t first_ns = 0;
+    while (segment) {
+        uint32_t length = offset + sizeof(Header) <= segment->size ? load_length(segment->data + offset) : kSealed;
+        if (length == kSealed) {
+            // A full segment; the writer continues in the next one
+            auto next = next_segment(*segment);
+            if (!next) break;
+            segment = std::move(next);
+            offset = 0;
+            continue;
+        }
+        if (length < sizeof(Header) || offset + length > segment->size) {
+            break; // Caught up with the writer
+        }
+
+        Header header;
+        memcpy(&header, segment->data + offset, sizeof(header));
+        const char* content = segment->data + offset + sizeof(Header);
+        offset += record_bytes(length - sizeof(Header));
+        if (header.seq < from_seq) continue;
+
+        if (pace == Pace::Original) {
+            if (count == 0) {
+                first_ns = header.time_ns;
+            } else {
+                std::this_thread::sleep_until(started + std::chrono::nanoseconds(header.time_ns - first_ns));
+            }
+        }
+        ++count;
+        Record record{header.seq, std::chrono::system_clock::time_point(
+                                      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                                          std::chrono::nanoseconds(header.time_ns))),
+                      std::string_view(content, length - sizeof(Header))};
+        if (!fn(record)) break;
+    }
+    return count;
+}
+
+json TopicLog::to_json() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t bytes = 0;
+    for (const auto& segment : segments_) {
+        bytes += segment->size;
+    }
+    return {
+        {"segments", segments_.size()},
+        {"bytes", bytes},
+        {"first_seq", segments_.empty() ? next_seq_ : segments_.front()->first_seq},
+        {"next_seq", next_seq_},
+        {"appended", appended_},
+        {"dropped_segments", dropped_segments_},
+        {"syncs", syncs_}
+    };
+}
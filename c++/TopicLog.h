@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "json.hpp"
+
+// Append-only log of one topic's messages in a directory of fixed-size
+// segment files, each named after its first sequence number and written
+// through a shared mapping, so an append is a copy into the page cache.
+// Readers work lock-free on the same mappings while the writer appends, and
+// replay from any sequence number or time. Segments older or beyond the
+// retention limits are deleted as new ones are started.
+//
+// Record layout (8-byte aligned): u32 length of header and content,
+// u32 reserved, u64 seq, i64 Unix time in ns, content. The length is stored
+// last, so a record cut short by a crash reads as the end of the log; a
+// length of kSealed means the log continues in the next segment.
+class TopicLog {
+public:
+    struct Options {
+        size_t segment_bytes = 64 << 20;
+        uint64_t retention_bytes = 1ULL << 30;     // 0 keeps any size
+        std::chrono::seconds retention_age{0};     // 0 keeps any age
+        bool read_only = false;                    // Replay a log another process writes
+
+        // Appends land in the page cache, so by default the log survives a
+        // crash of the process but not of the machine. These flush it to
+        // disk: each segment once it is full, and/or the records appended
+        // since the last flush once sync_interval has passed (checked on
+        // append). Either one also flushes when the log is closed.
+        bool sync_on_seal = false;
+        std::chrono::milliseconds sync_interval{0};  // 0 never
+    };
+
+    struct Record {
+        uint64_t seq;
+        std::chrono::system_clock::time_point time;
+        std::string_view content;  // Valid during the replay callback
+    };
+
+    enum class Pace {
+        Fast,      // As fast as the callback takes records
+        Original   // Spaced as they were appended
+    };
+
+    // Opens or creates the log in dir, recovering the records already there
+    TopicLog(const std::string& dir, const Options& options);
+    TopicLog(const std::string& dir) : TopicLog(dir, Options()) {}
+    ~TopicLog();
+
+    TopicLog(const TopicLog&) = delete;
+    TopicLog& operator=(const TopicLog&) = delete;
+
+    // Returns the record's sequence number; 0 if the log is read-only or the
+    // content does not fit in a segment
+    uint64_t append(const std::string& content,
+                    std::chrono::system_clock::time_point time = std::chrono::system_clock::now());
+
+    // Oldest sequence number still retained, and the one the next append gets
+    uint64_t first_seq() const;
+    uint64_t next_seq() const;
+
+    // First record appended at or after time; next_seq() if none
+    uint64_t seq_at(std::chrono::system_clock::time_point time) const;
+
+    // Calls fn for the records from from_seq (clamped to first_seq()) up to
+    // the end of the log, including records appended meanwhile; fn returns
+    // false to stop. Returns the number of records passed to fn.
+    uint64_t replay(uint64_t from_seq, const std::function<bool(const Record&)>& fn, Pace pace = Pace::Fast) const;
+
+    // {"segments", "bytes", "first_seq", "next_seq", "appended", "dropped_segments", "syncs"}
+    nlohmann::json to_json() const;
+
+private:
+    struct Header {
+        uint32_t length;
+        uint32_t reserved;
+        uint64_t seq;
+        int64_t time_ns;
+    };
+
+    // One record in kIndexInterval, for seeking by sequence number or time
+    struct IndexEntry {
+        uint64_t seq;
+        int64_t time_ns;
+        size_t offset;
+    };
+    static constexpr uint64_t kIndexInterval = 64;
+    static constexpr uint32_t kSealed = 0xffffffff;
+
+    // Kept alive by readers after retention deletes the file
+    struct Segment {
+        std::string path;
+        uint64_t first_seq = 0;
+        char* data = nullptr;
+        size_t size = 0;
+        // Writer state and index, under the log's mutex_. Readers go by the
+        // record sizes in the mapping instead.
+        size_t end = 0;
+        size_t synced = 0;  // Flushed to disk up to here
+        bool sealed = false;
+        int64_t last_time_ns = 0;
+        std::vector<IndexEntry> index;
+
+        ~Segment();
+    };
+
+    const std::string dir_;
+    const Options options_;
+
+    // Segment list, index and the writer. A read-only log reloads the list
+    // from the directory as readers reach its end.
+    mutable std::mutex mutex_;
+    mutable std::deque<std::shared_ptr<Segment>> segments_;
+    mutable uint64_t next_seq_ = 1;
+    uint64_t appended_ = 0;
+    uint64_t dropped_segments_ = 0;
+    uint64_t syncs_ = 0;
+    std::chrono::steady_clock::time_point last_sync_;
+
+    static size_t record_bytes(size_t content_size);
+    std::shared_ptr<Segment> map_segment(const std::string& path, uint64_t first_seq, bool create) const;
+    static uint64_t recover(Segment& segment);  // Returns the last seq found, 0 if none
+    void load_segments() const;                 // Caller holds mutex_
+    void start_segment();     // Caller holds mutex_
+    void apply_retention();   // Caller holds mutex_
+    void sync(Segment& segment);  // Caller holds mutex_
+    // Segment and offset to start reading from_seq at
+    std::pair<std::shared_ptr<Segment>, size_t> seek(uint64_t from_seq) const;
+    std::shared_ptr<Segment> next_segment(const Segment& segment) const;
+};
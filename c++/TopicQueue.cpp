@@ -0,0 +1,126 @@
+#include "TopicQueue.h"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+
+TopicQueue::State::State(size_t capacity, QueuePolicy policy)
+    : capacity(std::max<size_t>(1, capacity)), policy(policy),
+      event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+TopicQueue::State::~State() {
+    close(event_fd);
+}
+
+void TopicQueue::State::push(const std::string& topic, const std::string& content) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (closed) return;
+
+    if (policy == QueuePolicy::Conflate) {
+        auto it = positions.find(topic);
+        if (it != positions.end()) {
+            messages[it->second - popped].content = content;
+            ++conflated;
+            return;
+        }
+    }
+
+    if (messages.size() >= capacity) {
+        switch (policy) {
+            case QueuePolicy::DropNewest:
+                ++dropped;
+                return;
+            case QueuePolicy::Block:
+                ++blocked;
+                not_full.wait(lock, [this] { return messages.size() < capacity || closed; });
+                if (closed) return;
+                break;
+            default:
+                pop_front();
+                ++dropped;
+                break;
+        }
+    }
+
+    if (policy == QueuePolicy::Conflate) {
+        positions[topic] = popped + messages.size();
+    }
+    messages.push_back(Message{topic, content});
+    if (messages.size() == 1) {
+        uint64_t one = 1;
+        write(event_fd, &one, sizeof(one));
+        not_empty.notify_one();
+    }
+}
+
+TopicQueue::Message TopicQueue::State::pop_front() {
+    if (policy == QueuePolicy::Conflate) {
+        positions.erase(messages.front().topic);
+    }
+    Message message = std::move(messages.front());
+    messages.pop_front();
+    ++popped;
+    return message;
+}
+
+TopicQueue::TopicQueue(size_t capacity, QueuePolicy policy)
+    : state_(std::make_shared<State>(capacity, policy)) {}
+
+TopicQueue::~TopicQueue() {
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->closed = true;
+    }
+    state_->not_full.notify_all(); // Release deliveries blocked on a full queue
+    if (unsubscribe_) {
+        unsubscribe_();
+    }
+}
+
+size_t TopicQueue::poll(std::vector<Message>& batch, size_t max_batch) {
+    batch.clear();
+    State& s = *state_;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        size_t n = std::min(max_batch, s.messages.size());
+        for (size_t i = 0; i < n; ++i) {
+            batch.push_back(s.pop_front());
+        }
+        if (n > 0 && s.messages.empty()) {
+            uint64_t count;
+            read(s.event_fd, &count, sizeof(count)); // No longer readable
+        }
+    }
+    if (s.policy == QueuePolicy::Block && !batch.empty()) {
+        s.not_full.notify_all();
+    }
+    return batch.size();
+}
+
+bool TopicQueue::wait_for(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    return state_->not_empty.wait_for(lock, timeout, [this] { return !state_->messages.empty(); });
+}
+
+int TopicQueue::fd() const {
+    return state_->event_fd;
+}
+
+size_t TopicQueue::size() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->messages.size();
+}
+
+uint64_t TopicQueue::dropped() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->dropped;
+}
+
+uint64_t TopicQueue::conflated() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->conflated;
+}
+
+uint64_t TopicQueue::blocked() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->blocked;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// What a full TopicQueue does with the next message
+enum class QueuePolicy {
+    DropOldest,  // Evict the oldest queued message
+    DropNewest,  // Discard the incoming message
+    Conflate,    // Keep only the latest message per topic; evict the oldest topic when full
+    Block        // Make the delivering thread wait, which backs up the sending peer's connection
+};
+
+// Bounded queue of the messages on a subscription, drained by the consumer in
+// batches instead of through a per-message callback. fd() is an eventfd that
+// is readable while messages are queued, for epoll/poll based event loops.
+// Returned by GossipNode::open_queue(); destroying it unsubscribes.
+class TopicQueue {
+public:
+    struct Message {
+        std::string topic;
+        std::string content;
+    };
+
+    ~TopicQueue();
+
+    TopicQueue(const TopicQueue&) = delete;
+    TopicQueue& operator=(const TopicQueue&) = delete;
+
+    // Moves up to max_batch messages, oldest first, into batch (cleared
+    // first, keeping its capacity). Returns the number moved.
+    size_t poll(std::vector<Message>& batch, size_t max_batch = SIZE_MAX);
+
+    // Blocks until a message is queued or the timeout passes; true if one is
+    bool wait_for(std::chrono::milliseconds timeout);
+
+    int fd() const;
+    size_t size() const;
+    uint64_t dropped() const;    // Discarded by DropOldest, DropNewest or a Conflate eviction
+    uint64_t conflated() const;  // Replaced by a newer message on the same topic
+    uint64_t blocked() const;    // Deliveries that had to wait for room
+
+private:
+    friend class GossipNode;
+
+    // Shared with the subscription callback, which may still be running
+    // when the TopicQueue goes away
+    struct State {
+        State(size_t capacity, QueuePolicy policy);
+        ~State();
+
+        void push(const std::string& topic, const std::string& content);
+        Message pop_front();  // Caller holds mutex
+
+        const size_t capacity;
+        const QueuePolicy policy;
+        const int event_fd;
+
+        mutable std::mutex mutex;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+        std::deque<Message> messages;
+        uint64_t popped = 0;  // Messages ever taken off the front
+        std::unordered_map<std::string, uint64_t> positions;  // Conflate: topic -> popped + index
+        bool closed = false;
+        uint64_t dropped = 0;
+        uint64_t conflated = 0;
+        uint64_t blocked = 0;
+    };
+
+    TopicQueue(size_t capacity, QueuePolicy policy);
+
+    std::shared_ptr<State> state_;
+    std::function<void()> unsubscribe_;  // Set by GossipNode::open_queue
+};
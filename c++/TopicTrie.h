@@ -0,0 +1,183 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Topic matcher for hierarchical topic names ("site/line3/camera/7/frames").
+// Patterns follow MQTT: '+' matches exactly one level and '#' as the last
+// level matches zero or more remaining levels. A '#' anywhere else is an
+// ordinary level name, for the trie and matches() alike. Matching walks one
+// trie path per wildcard branch, so its cost depends on the topic depth and
+// the number of matching patterns, not on how many patterns are stored.
+// Copies are deep, so a trie can be used as an RCU snapshot.
+template <typename T>
+class TopicTrie {
+public:
+    // Value stored for a pattern, created on first use
+    T& operator[](const std::string& pattern) {
+        Node* node = &root_;
+        size_t begin = 0;
+        while (true) {
+            size_t end = pattern.find('/', begin);
+            std::string level = pattern.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+
+            if (level == "#" && end == std::string::npos) {
+                if (!node->hash) {
+                    node->hash = std::make_unique<T>();
+                    ++size_;
+                }
+                return *node->hash;
+            }
+
+            std::unique_ptr<Node>& child = level == "+" ? node->plus : node->children[level];
+            if (!child) child = std::make_unique<Node>();
+            node = child.get();
+
+            if (end == std::string::npos) break;
+            begin = end + 1;
+        }
+        if (!node->value) {
+            node->value = std::make_unique<T>();
+            ++size_;
+        }
+        return *node->value;
+    }
+
+    // Removes a pattern and its value. Empty trie nodes are left in place;
+    // they cost memory but not matching time.
+    bool erase(const std::string& pattern) {
+        Node* node = &root_;
+        size_t begin = 0;
+        while (node) {
+            size_t end = pattern.find('/', begin);
+            std::string level = pattern.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+
+            if (level == "#" && end == std::string::npos) {
+                return release(node->hash);
+            }
+            if (level == "+") {
+                node = node->plus.get();
+            } else {
+                auto it = node->children.find(level);
+                node = it == node->children.end() ? nullptr : it->second.get();
+            }
+            if (end == std::string::npos) {
+                return node && release(node->value);
+            }
+            begin = end + 1;
+        }
+        return false;
+    }
+
+    // Value stored for exactly this pattern, or nullptr
+    const T* find(const std::string& pattern) const {
+        const Node* node = &root_;
+        size_t begin = 0;
+        while (node) {
+            size_t end = pattern.find('/', begin);
+            std::string level = pattern.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+
+            if (level == "#" && end == std::string::npos) {
+                return node->hash.get();
+            }
+            if (level == "+") {
+                node = node->plus.get();
+            } else {
+                auto it = node->children.find(level);
+                node = it == node->children.end() ? nullptr : it->second.get();
+            }
+            if (end == std::string::npos) {
+                return node ? node->value.get() : nullptr;
+            }
+            begin = end + 1;
+        }
+        return nullptr;
+    }
+
+    // Calls visit(const T&) for every stored pattern matching the topic
+    template <typename Visitor>
+    void match(const std::string& topic, Visitor&& visit) const {
+        std::string level;
+        match_from(&root_, topic, 0, level, visit);
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    static bool is_pattern(const std::string& topic) {
+        return topic.find('+') != std::string::npos || topic.find('#') != std::string::npos;
+    }
+
+    // Single pattern check without building a trie
+    static bool matches(const std::string& pattern, const std::string& topic) {
+        std::vector<std::string> p = split(pattern), t = split(topic);
+        for (size_t i = 0; i < p.size(); ++i) {
+            if (p[i] == "#" && i + 1 == p.size()) return true;
+            if (i >= t.size() || (p[i] != "+" && p[i] != t[i])) return false;
+        }
+        return p.size() == t.size();
+    }
+
+private:
+    struct Node {
+        std::unordered_map<std::string, std::unique_ptr<Node>> children;
+        std::unique_ptr<Node> plus;   // '+' at this level
+        std::unique_ptr<T> value;     // pattern ends here
+        std::unique_ptr<T> hash;      // pattern ends with '#' here
+
+        Node() = default;
+        Node(const Node& other)
+            : plus(clone(other.plus)), value(clone(other.value)), hash(clone(other.hash)) {
+            for (const auto& child : other.children) {
+                children.emplace(child.first, clone(child.second));
+            }
+        }
+    };
+
+    template <typename U>
+    static std::unique_ptr<U> clone(const std::unique_ptr<U>& p) {
+        return p ? std::make_unique<U>(*p) : nullptr;
+    }
+
+    Node root_;
+    size_t size_ = 0;
+
+    static std::vector<std::string> split(const std::string& topic) {
+        std::vector<std::string> levels;
+        size_t begin = 0, end;
+        while ((end = topic.find('/', begin)) != std::string::npos) {
+            levels.push_back(topic.substr(begin, end - begin));
+            begin = end + 1;
+        }
+        levels.push_back(topic.substr(begin));
+        return levels;
+    }
+
+    bool release(std::unique_ptr<T>& slot) {
+        if (!slot) return false;
+        slot.reset();
+        --size_;
+        return true;
+    }
+
+    // pos is the start of the current level, or npos once every level of the
+    // topic has been consumed.
+    template <typename Visitor>
+    static void match_from(const Node* node, const std::string& topic, size_t pos, std::string& level, Visitor& visit) {
+        if (node->hash) visit(*node->hash);  // '#' also matches the parent level
+        if (pos == std::string::npos) {
+            if (node->value) visit(*node->value);
+            return;
+        }
+
+        size_t end = topic.find('/', pos);
+        size_t next = end == std::string::npos ? std::string::npos : end + 1;
+
+        level.assign(topic, pos, end == std::string::npos ? std::string::npos : end - pos);
+        auto it = node->children.find(level);
+        if (it != node->children.end()) match_from(it->second.get(), topic, next, level, visit);
+        if (node->plus) match_from(node->plus.get(), topic, next, level, visit);
+    }
+};
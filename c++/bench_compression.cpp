@@ -0,0 +1,145 @@
+#include "GossipNode.h"
+#include "Compression.h"
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <thread>
+
+// Compression benchmark. Runs the LZ codec over representative payloads
+// (JSON sensor readings, log text, a raw grayscale camera frame and an
+// already compressed, JPEG-like frame) and reports ratio, compression and
+// decompression throughput and the cost of the entropy sample that skips
+// incompressible data. Then publishes JSON readings between two nodes with
+// and without compression and compares the bytes on the wire.
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static std::string sensor_json(std::mt19937& rng, int readings) {
+    std::string out = "[";
+    for (int i = 0; i < readings; ++i) {
+        if (i) out += ",";
+        out += "{\"sensor\":\"site/floor" + std::to_string(rng() % 4) + "/temp" + std::to_string(rng() % 16) +
+               "\",\"value\":" + std::to_string(20 + int(rng() % 500) / 100.0) +
+               ",\"unit\":\"C\",\"ts\":" + std::to_string(1700000000000ULL + i * 10) + "}";
+    }
+    return out + "]";
+}
+
+static std::string log_text(std::mt19937& rng, size_t size) {
+    const char* levels[] = {"INFO", "WARN", "DEBUG"};
+    const char* events[] = {"connection accepted from", "frame dropped for", "credit grant sent to",
+                            "membership changed, peer", "retrying publish to"};
+    std::string out;
+    while (out.size() < size) {
+        out += "2026-10-18T12:00:" + std::to_string(rng() % 60) + "Z " + levels[rng() % 3] + " gossip: " +
+               events[rng() % 5] + " 10.0.0." + std::to_string(rng() % 255) + ":" +
+               std::to_string(7000 + rng() % 100) + "\n";
+    }
+    out.resize(size);
+    return out;
+}
+
+// 640x480 8-bit frame: smooth shading with a little sensor noise
+static std::string camera_frame(std::mt19937& rng) {
+    const int width = 640, height = 480;
+    std::string out(width * height, 0);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            double shade = 128 + 60 * std::sin(x / 40.0) * std::cos(y / 55.0) + (x > 300 && x < 420 ? 40 : 0);
+            out[y * width + x] = char(std::min(255.0, shade + (rng() % 4 == 0 ? int(rng() % 3) - 1 : 0)));
+        }
+    }
+    return out;
+}
+
+static std::string random_bytes(std::mt19937& rng, size_t size) {
+    std::string out(size, 0);
+    for (auto& c : out) c = char(rng());
+    return out;
+}
+
+int main() {
+    std::mt19937 rng(42);
+    std::vector<std::pair<std::string, std::string>> payloads = {
+        {"sensor JSON 1 KB", sensor_json(rng, 12)},
+        {"sensor JSON 16 KB", sensor_json(rng, 190)},
+        {"log text 8 KB", log_text(rng, 8 * 1024)},
+        {"raw camera 300 KB", camera_frame(rng)},
+        {"JPEG-like 64 KB", random_bytes(rng, 64 * 1024)},
+    };
+
+    for (const auto& [name, payload] : payloads) {
+        const size_t total = 256 << 20; // Bytes per measurement
+        size_t rounds = std::max<size_t>(1, total / payload.size());
+
+        auto start = Clock::now();
+        bool worth = false;
+        for (size_t i = 0; i < rounds; ++i) {
+            worth = lz_worth_trying(payload.data(), payload.size());
+        }
+        double sample_ns = seconds_since(start) / rounds * 1e9;
+
+        std::string packed;
+        start = Clock::now();
+        for (size_t i = 0; i < rounds; ++i) {
+            packed.clear();
+            lz_compress(payload.data(), payload.size(), packed);
+        }
+        double compress_s = seconds_since(start);
+
+        std::string unpacked;
+        start = Clock::now();
+        for (size_t i = 0; i < rounds; ++i) {
+            lz_decompress(packed.data(), packed.size(), unpacked);
+        }
+        double decompress_s = seconds_since(start);
+        if (unpacked != payload) {
+            std::cerr << name << ": round trip failed\n";
+            return 1;
+        }
+
+        std::cout << name << ": ratio " << double(payload.size()) / packed.size() << ", compress "
+                  << rounds * payload.size() / compress_s / 1e6 << " MB/s, decompress "
+                  << rounds * payload.size() / decompress_s / 1e6 << " MB/s, sample " << sample_ns << " ns ("
+                  << (worth ? "compress" : "skip") << ")" << std::endl;
+    }
+
+    // End to end: 20k JSON readings of about 1 KB, bytes sent on the wire
+    const std::string& reading = payloads[0].second;
+    int port = 7340;
+    for (bool compressed : {false, true}) {
+        GossipConfig config;
+        if (compressed) config.compressed_topics = {"site/#"};
+        GossipNode receiver("127.0.0.1", port);
+        std::atomic<int> received{0};
+        receiver.subscribe("site/readings", [&](const std::string&, const std::string&) { ++received; });
+        GossipNode sender("127.0.0.1", port + 1, config);
+        sender.add_known_node("127.0.0.1", port);
+        port += 2;
+        std::this_thread::sleep_for(std::chrono::seconds(3)); // Learn topics
+
+        const int kMessages = 20000;
+        auto start = Clock::now();
+        for (int i = 0; i < kMessages; ++i) {
+            sender.publish("site/readings", reading);
+        }
+        auto deadline = Clock::now() + std::chrono::seconds(30);
+        while (received < kMessages && Clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        double total_s = seconds_since(start);
+
+        auto stats = nlohmann::json::parse(sender.get_stats_json());
+        uint64_t wire = 0;
+        for (const auto& lane : stats["lanes"]) wire += lane["bytes"].get<uint64_t>();
+        std::cout << (compressed ? "publish, compressed:   " : "publish, uncompressed: ") << wire / kMessages
+                  << " B/message on the wire, " << received / total_s / 1e3 << " k msgs/s, publish p50 "
+                  << stats["publish_latency"]["p50_us"] << " us" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "GossipNode.h"
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+// Skewed dispatch benchmark: one publisher sends a heavy camera topic (64 KB
+// frames, 300 us of callback work each) interleaved with 32 light sensor
+// topics over a single connection. With callbacks on the connection handler
+// thread, every sensor reading waits behind the frames ahead of it; the
+// dispatch pool runs the camera strand on one worker and the sensors on the
+// others. Reports sensor delivery latency and the total delivery time.
+
+using Clock = std::chrono::steady_clock;
+
+static void busy_for(std::chrono::microseconds work) {
+    auto until = Clock::now() + work;
+    while (Clock::now() < until) {}
+}
+
+static std::string stamped(size_t size) {
+    std::string payload = std::to_string(Clock::now().time_since_epoch().count());
+    payload.resize(std::max(size, payload.size() + 1), ' ');
+    return payload;
+}
+
+int main() {
+    const int kRounds = 2000;
+    const int kSensors = 32;
+    const int kSensorsPerRound = 8;
+    const auto kFrameWork = std::chrono::microseconds(300);
+
+    std::cout << "hardware threads: " << std::thread::hardware_concurrency() << "\n";
+    int port = 7310;
+    for (int threads : {0, 1, 2, 4, 8}) {
+        GossipConfig config;
+        config.dispatch_threads = threads;
+        GossipNode receiver("127.0.0.1", port, config);
+
+        std::atomic<int> frames{0}, readings{0};
+        LatencyHistogram sensor_latency;
+        receiver.subscribe("site/camera", [&](const std::string&, const std::string&) {
+            busy_for(kFrameWork);
+            ++frames;
+        });
+        receiver.subscribe("site/sensor/+", [&](const std::string&, const std::string& content) {
+            Clock::time_point sent{Clock::duration(std::stoll(content))};
+            sensor_latency.record(Clock::now() - sent);
+            ++readings;
+        });
+
+        GossipNode sender("127.0.0.1", port + 1);
+        sender.add_known_node("127.0.0.1", port);
+        port += 2;
+        std::this_thread::sleep_for(std::chrono::seconds(3)); // Learn topics
+
+        auto start = Clock::now();
+        for (int round = 0; round < kRounds; ++round) {
+            sender.publish("site/camera", stamped(64 * 1024));
+            for (int i = 0; i < kSensorsPerRound; ++i) {
+                int sensor = (round * kSensorsPerRound + i) % kSensors;
+                sender.publish("site/sensor/" + std::to_string(sensor), stamped(32));
+            }
+        }
+        auto deadline = Clock::now() + std::chrono::seconds(60);
+        while ((frames < kRounds || readings < kRounds * kSensorsPerRound) && Clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        double total_s = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::cout << (threads ? std::to_string(threads) + " dispatch threads" : std::string("handler thread  "))
+                  << ": sensor p50 " << sensor_latency.percentile(0.5).count() / 1000.0 << " us, p99 "
+                  << sensor_latency.percentile(0.99).count() / 1000.0 << " us; all delivered in "
+                  << total_s << " s (" << frames << " frames, " << readings << " readings)" << std::endl;
+    }
+    return 0;
+}
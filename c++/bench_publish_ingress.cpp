@@ -0,0 +1,86 @@
+#include "GossipNode.h"
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Publish ingress benchmark: 1 to 32 application threads publish to one
+// subscriber on localhost. Compares publish() (caller does the sends),
+// publish_queued() and publish_queued() with 32-message batches. Reports the
+// per-call latency seen by the producers and the rate at which messages
+// reach the subscriber.
+
+enum class Mode { Direct, Queued, Batched };
+
+static const char* mode_name(Mode mode) {
+    switch (mode) {
+        case Mode::Direct:  return "publish()       ";
+        case Mode::Queued:  return "publish_queued()";
+        default:            return "batch of 32     ";
+    }
+}
+
+int main() {
+    const size_t kMessages = 100000;
+    const size_t kBatch = 32;
+    const std::string payload(64, 'x');
+
+    GossipNode receiver("127.0.0.1", 7301);
+    std::atomic<uint64_t> received{0};
+    receiver.subscribe("bench/+", [&](const std::string&, const std::string&) { ++received; });
+
+    GossipNode sender("127.0.0.1", 7302);
+    sender.add_known_node("127.0.0.1", 7301);
+    std::this_thread::sleep_for(std::chrono::seconds(3)); // Learn topics and capabilities
+
+    std::cout << "hardware threads: " << std::thread::hardware_concurrency() << "\n";
+    for (int producers : {1, 2, 4, 8, 16, 32}) {
+        for (Mode mode : {Mode::Direct, Mode::Queued, Mode::Batched}) {
+            LatencyHistogram call_latency;
+            uint64_t start_count = received;
+            size_t per_thread = kMessages / producers;
+            size_t total = per_thread * producers;
+
+            auto start = std::chrono::steady_clock::now();
+            std::vector<std::thread> threads;
+            for (int p = 0; p < producers; ++p) {
+                threads.emplace_back([&, p] {
+                    std::string topic = "bench/" + std::to_string(p);
+                    for (size_t i = 0; i < per_thread;) {
+                        auto call_start = std::chrono::steady_clock::now();
+                        size_t n = 1;
+                        if (mode == Mode::Direct) {
+                            sender.publish(topic, payload);
+                        } else if (mode == Mode::Queued) {
+                            sender.publish_queued(topic, payload);
+                        } else {
+                            GossipNode::PublishBatch batch;
+                            n = std::min(kBatch, per_thread - i);
+                            for (size_t k = 0; k < n; ++k) batch.add(topic, payload);
+                            sender.publish_queued(std::move(batch));
+                        }
+                        call_latency.record((std::chrono::steady_clock::now() - call_start) / n);
+                        i += n;
+                    }
+                });
+            }
+            for (auto& t : threads) t.join();
+            auto calls_done = std::chrono::steady_clock::now();
+
+            auto deadline = calls_done + std::chrono::seconds(30);
+            while (received - start_count < total && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+            auto delivered = std::chrono::steady_clock::now();
+
+            double call_s = std::chrono::duration<double>(calls_done - start).count();
+            double delivery_s = std::chrono::duration<double>(delivered - start).count();
+            std::cout << producers << " producers, " << mode_name(mode)
+                      << ": call p50 " << call_latency.percentile(0.5).count() / 1000.0 << " us, p99 "
+                      << call_latency.percentile(0.99).count() / 1000.0 << " us; "
+                      << total / call_s / 1000 << "k calls/s, " << (received - start_count) / delivery_s / 1000
+                      << "k delivered/s (" << received - start_count << "/" << total << ")" << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "GossipNode.h"
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+// Numeric series benchmark. Encodes 100 Hz sensor feeds of different shapes
+// with SeriesEncoder and compares their size to the formatted strings
+// publisher.cpp sends ("Temperature is 21.5°C") and to raw 16-byte
+// (timestamp, double) samples. Then sends the same feed between two nodes
+// as text messages and with publish_series() and compares the bytes on the
+// wire.
+
+using Clock = std::chrono::steady_clock;
+using SystemClock = std::chrono::system_clock;
+
+struct Feed {
+    std::string name;
+    std::function<double(int)> value;
+    bool integers;
+};
+
+static std::string formatted(const std::string& topic, double value, bool integer) {
+    std::ostringstream out;
+    out << topic << " is ";
+    if (integer) {
+        out << int64_t(value);
+    } else {
+        out << std::fixed << std::setprecision(2) << value;
+    }
+    out << "°C";
+    return out.str();
+}
+
+int main() {
+    std::mt19937 rng(7);
+    std::normal_distribution<double> noise(0, 0.05);
+    double walk = 20;
+    std::vector<Feed> feeds = {
+        {"counter (int)", [](int i) { return double(i); }, true},
+        {"temperature, 0.1 steps", [](int i) { return 20 + (i / 50) * 0.1; }, false},
+        {"temperature, 2 decimals", [&](int) { return std::round((walk += noise(rng)) * 100) / 100; }, false},
+        {"random walk, full precision", [&](int) { return walk += noise(rng); }, false},
+    };
+
+    const int kSamples = 100000;
+    for (const auto& feed : feeds) {
+        std::vector<std::pair<SystemClock::time_point, double>> samples;
+        size_t text_bytes = 0;
+        auto time = SystemClock::now();
+        for (int i = 0; i < kSamples; ++i) {
+            time += std::chrono::milliseconds(10) + std::chrono::microseconds(rng() % 300); // Sleep jitter
+            samples.emplace_back(time, feed.value(i));
+            text_bytes += formatted("Temperature", samples.back().second, feed.integers).size();
+        }
+
+        SeriesEncoder encoder;
+        size_t series_bytes = 0;
+        auto start = Clock::now();
+        for (const auto& [at, value] : samples) {
+            if (feed.integers) {
+                encoder.add(at, int64_t(value));
+            } else {
+                encoder.add(at, value);
+            }
+            if (encoder.size() == 100) { // One block per second
+                series_bytes += encoder.finish().size();
+            }
+        }
+        double encode_s = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::cout << feed.name << ": " << double(series_bytes) / kSamples << " B/sample, "
+                  << double(text_bytes) / series_bytes << "x smaller than text, "
+                  << 16.0 * kSamples / series_bytes << "x smaller than raw, encode "
+                  << encode_s / kSamples * 1e9 << " ns/sample" << std::endl;
+    }
+
+    // End to end: 2000 samples of the 0.1-step temperature, 100 per block
+    int port = 7350;
+    for (bool series : {false, true}) {
+        GossipConfig config;
+        config.series_max_points = 100;
+        GossipNode receiver("127.0.0.1", port);
+        std::atomic<int> received{0};
+        if (series) {
+            receiver.subscribe_series("Temperature", [&](const std::string&, const SeriesPoint&) { ++received; });
+        } else {
+            receiver.subscribe("Temperature", [&](const std::string&, const std::string&) { ++received; });
+        }
+        GossipNode sender("127.0.0.1", port + 1, config);
+        sender.add_known_node("127.0.0.1", port);
+        port += 2;
+        std::this_thread::sleep_for(std::chrono::seconds(3)); // Learn topics
+
+        const int kMessages = 2000;
+        auto time = SystemClock::now();
+        for (int i = 0; i < kMessages; ++i) {
+            time += std::chrono::milliseconds(10);
+            double value = feeds[1].value(i);
+            if (series) {
+                sender.publish_series("Temperature", value, time);
+            } else {
+                sender.publish("Temperature", formatted("Temperature", value, false));
+            }
+        }
+        auto deadline = Clock::now() + std::chrono::seconds(10);
+        while (received < kMessages && Clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        auto stats = nlohmann::json::parse(sender.get_stats_json());
+        uint64_t wire = 0;
+        for (const auto& lane : stats["lanes"]) wire += lane["bytes"].get<uint64_t>();
+        std::cout << (series ? "publish_series: " : "publish text:   ") << double(wire) / kMessages
+                  << " B/sample on the wire (" << received << " samples received)" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "SubscriptionRegistry.h"
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+// Dispatch lookup microbenchmark: reader threads match random topics while
+// one thread keeps subscribing and unsubscribing. SubscriptionRegistry is
+// compared with a TopicTrie behind a std::shared_mutex, the simplest safe
+// alternative.
+
+using Callback = SubscriptionRegistry::Callback;
+
+struct LockedTrie {
+    TopicTrie<std::vector<Callback>> trie;
+    mutable std::shared_mutex mutex;
+
+    void add(const std::string& topic, Callback callback) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        trie[topic].push_back(std::move(callback));
+    }
+    void remove(const std::string& topic) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        auto& callbacks = trie[topic];
+        callbacks.pop_back();
+        if (callbacks.empty()) trie.erase(topic);
+    }
+    template <typename Visitor>
+    void match(const std::string& topic, Visitor&& visit) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        trie.match(topic, [&](const std::vector<Callback>& callbacks) {
+            for (const auto& cb : callbacks) visit(cb);
+        });
+    }
+};
+
+static std::string topic_name(uint32_t n) {
+    return "site" + std::to_string(n % 100) + "/line" + std::to_string(n / 100 % 20) + "/camera/" + std::to_string(n % 997) + "/frames";
+}
+
+struct Result {
+    double lookup_ns;
+    double churn_per_second;
+};
+
+template <typename Add, typename Remove, typename Match>
+static Result run(int readers, bool churn, Add add, Remove remove, Match match) {
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> lookups{0}, matches{0}, changes{0};
+    std::vector<std::thread> threads;
+
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r] {
+            std::mt19937 rng(r);
+            std::vector<std::string> topics;
+            for (int i = 0; i < 1024; ++i) topics.push_back(topic_name(rng() % 20000));
+            uint64_t n = 0, matched = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                match(topics[n++ % topics.size()], [&](const Callback&) { ++matched; });
+            }
+            lookups += n;
+            matches += matched;
+        });
+    }
+    if (churn) {
+        threads.emplace_back([&] {
+            std::mt19937 rng(99);
+            uint64_t n = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                std::string topic = rng() % 4 ? topic_name(rng() % 20000) : "site" + std::to_string(rng() % 100) + "/+/camera/#";
+                auto id = add(topic);
+                remove(id, topic);
+                n += 2;
+            }
+            changes += n;
+        });
+    }
+
+    auto seconds = std::chrono::seconds(1);
+    std::this_thread::sleep_for(seconds);
+    stop = true;
+    for (auto& t : threads) t.join();
+
+    double elapsed_ns = std::chrono::duration<double, std::nano>(seconds).count();
+    return {elapsed_ns * readers / std::max<uint64_t>(lookups, 1), changes / 1.0};
+}
+
+int main() {
+    const size_t kTopics = 10000, kPatterns = 1000;
+    std::cout << "hardware threads: " << std::thread::hardware_concurrency() << "\n";
+
+    SubscriptionRegistry registry;
+    LockedTrie locked;
+    std::mt19937 rng(42);
+    for (size_t i = 0; i < kTopics; ++i) {
+        std::string topic = topic_name(rng() % 20000);
+        registry.add(topic, [](const std::string&, const std::string&) {});
+        locked.add(topic, [](const std::string&, const std::string&) {});
+    }
+    for (size_t i = 0; i < kPatterns; ++i) {
+        std::string pattern = "site" + std::to_string(rng() % 100) + "/line" + std::to_string(rng() % 20) + "/#";
+        registry.add(pattern, [](const std::string&, const std::string&) {});
+        locked.add(pattern, [](const std::string&, const std::string&) {});
+    }
+
+    for (int readers : {1, 2, 4, 8}) {
+        for (bool churn : {false, true}) {
+            Result r = run(readers, churn,
+                [&](const std::string& topic) { return registry.add(topic, [](const std::string&, const std::string&) {}); },
+                [&](SubscriptionRegistry::Id id, std::string topic) { registry.remove(id, topic); },
+                [&](const std::string& topic, auto&& visit) { registry.match(topic, visit); });
+            Result l = run(readers, churn,
+                [&](const std::string& topic) { locked.add(topic, [](const std::string&, const std::string&) {}); return topic; },
+                [&](const std::string& topic, const std::string&) { locked.remove(topic); },
+                [&](const std::string& topic, auto&& visit) { locked.match(topic, visit); });
+
+            std::cout << readers << " readers" << (churn ? ", churn:   " : ", no churn:") << " registry "
+                      << r.lookup_ns << " ns/lookup (" << r.churn_per_second << " changes/s), locked trie "
+                      << l.lookup_ns << " ns/lookup (" << l.churn_per_second << " changes/s)" << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "GossipNode.h"
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+
+// Topic log benchmark. Appends and replays (copying each record out) 64 B
+// to 64 KB records through a TopicLog, then publishes at 10k msgs/s with and
+// without logging and compares publish() latency. Usage: bench_topic_log
+// [dir] (default /tmp).
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    std::string root = std::string(argc > 1 ? argv[1] : "/tmp") + "/bench_topic_log";
+    std::filesystem::remove_all(root);
+
+    for (size_t size : {64, 1024, 16 * 1024, 64 * 1024}) {
+        const uint64_t total = 1ULL << 30; // Bytes per run
+        size_t count = total / size;
+        std::string payload(size, 'x');
+        TopicLog::Options options;
+        options.retention_bytes = 2 * total;
+        TopicLog log(root + "/size" + std::to_string(size), options);
+
+        auto start = Clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            log.append(payload);
+        }
+        double write_s = seconds_since(start);
+
+        uint64_t bytes = 0;
+        std::string copy;
+        start = Clock::now();
+        uint64_t read = log.replay(0, [&](const TopicLog::Record& record) {
+            copy.assign(record.content);
+            bytes += copy.size();
+            return true;
+        });
+        double read_s = seconds_since(start);
+
+        std::cout << size << " B records: write " << count / write_s / 1e6 << " M/s (" << total / write_s / 1e9
+                  << " GB/s), replay " << read / read_s / 1e6 << " M/s (" << bytes / read_s / 1e9 << " GB/s)\n";
+    }
+
+    // publish() with no peers: the cost of logging on the publishing thread
+    const int kRate = 10000;
+    const int kMessages = 50000;
+    for (bool logged : {false, true}) {
+        GossipConfig config;
+        if (logged) config.topic_log_dir = root + "/node";
+        GossipNode node("127.0.0.1", logged ? 7322 : 7321, config);
+        std::string payload(256, 'x');
+        auto next = Clock::now();
+        for (int i = 0; i < kMessages; ++i) {
+            node.publish("bench/log", payload);
+            next += std::chrono::microseconds(1000000 / kRate);
+            std::this_thread::sleep_until(next);
+        }
+        auto latency = nlohmann::json::parse(node.get_stats_json())["publish_latency"];
+        std::cout << (logged ? "publish, logged:     " : "publish, not logged: ") << "p50 " << latency["p50_us"]
+                  << " us, p99 " << latency["p99_us"] << " us, p999 " << latency["p999_us"] << " us\n";
+    }
+    std::filesystem::remove_all(root);
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "TopicTrie.h"
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+// Matcher microbenchmark: match cost of TopicTrie vs. the number of stored
+// subscription patterns, with a linear scan over the patterns for reference.
+
+// Distinct patterns, about a third of them with wildcards
+static std::vector<std::string> make_patterns(size_t count, std::mt19937& rng) {
+    std::unordered_set<std::string> patterns;
+    while (patterns.size() < count) {
+        std::string site = "site" + std::to_string(rng() % 100);
+        std::string line = "line" + std::to_string(rng() % 20);
+        std::string kind = rng() % 2 ? "camera" : "sensor";
+        std::string id = std::to_string(rng() % 1000);
+        switch (rng() % 10) {
+            case 0:  patterns.insert(site + "/+/" + kind + "/#"); break;
+            case 1:  patterns.insert(site + "/" + line + "/+/" + id + "/frames"); break;
+            case 2:  patterns.insert(site + "/" + line + "/#"); break;
+            default: patterns.insert(site + "/" + line + "/" + kind + "/" + id + "/frames"); break;
+        }
+    }
+    return {patterns.begin(), patterns.end()};
+}
+
+static std::vector<std::string> make_topics(size_t count, std::mt19937& rng) {
+    std::vector<std::string> topics;
+    for (size_t i = 0; i < count; ++i) {
+        topics.push_back("site" + std::to_string(rng() % 100) + "/line" + std::to_string(rng() % 20) + "/" +
+                         (rng() % 2 ? "camera" : "sensor") + "/" + std::to_string(rng() % 1000) + "/frames");
+    }
+    return topics;
+}
+
+int main() {
+    std::mt19937 rng(42);
+    std::vector<std::string> topics = make_topics(100000, rng);
+
+    for (size_t count : {1000, 10000, 100000}) {
+        std::vector<std::string> patterns = make_patterns(count, rng);
+        TopicTrie<size_t> trie;
+        for (size_t i = 0; i < patterns.size(); ++i) trie[patterns[i]] = i;
+
+        size_t matched = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& topic : topics) {
+            trie.match(topic, [&](size_t) { ++matched; });
+        }
+        double trie_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / topics.size();
+
+        // The linear scan is slow at 100k patterns; a sample is enough
+        size_t sample = 200, scanned = 0;
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < sample; ++i) {
+            for (const auto& pattern : patterns) {
+                scanned += TopicTrie<size_t>::matches(pattern, topics[i]);
+            }
+        }
+        double scan_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / sample;
+
+        std::cout << count << " patterns: trie " << trie_ns << " ns/match, linear scan " << scan_ns
+                  << " ns/match (" << double(matched) / topics.size() << " vs. " << double(scanned) / sample
+                  << " matches/topic)" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,29 @@
+#include "GossipAsync.h"
+#include <iostream>
+#include <chrono>
+#include <thread>
+
+// subscriber.cpp written with coroutines (build with -std=c++20)
+gossip::Task relay_temperature(GossipNode& node) {
+    gossip::Subscription temperature(node, "Temperature");
+    while (true) {
+        gossip::Message message = co_await temperature.next();
+        std::cout << "Received [" << message.topic << "]: " << message.content << std::endl;
+        co_await gossip::publish_async(node, "Humidity", "Humidity is" + message.content + "%");
+    }
+}
+
+int main() {
+    GossipNode node("192.168.178.126", 5000);
+    node.add_known_node("192.168.178.126", 5001);
+
+    relay_temperature(node);
+
+    std::cout << "Node is running... Waiting for messages." << std::endl;
+
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    return 0;
+}
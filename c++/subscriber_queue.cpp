@@ -0,0 +1,28 @@
+#include "GossipNode.h"
+#include <iostream>
+#include <chrono>
+
+// subscriber.cpp with a pull-based queue: no callback, no flag polling. The
+// main loop sleeps until readings arrive and handles them in batches.
+int main() {
+    GossipNode node("192.168.178.126", 5000);
+    node.add_known_node("192.168.178.126", 5001);
+
+    auto temperature = node.open_queue("Temperature", 256, QueuePolicy::DropOldest);
+    std::vector<TopicQueue::Message> batch;
+
+    std::cout << "Node is running... Waiting for messages." << std::endl;
+
+    while (true) {
+        if (!temperature->wait_for(std::chrono::seconds(1))) {
+            continue;
+        }
+        temperature->poll(batch);
+        for (const auto& message : batch) {
+            std::cout << "Received [" << message.topic << "]: " << message.content << std::endl;
+            node.publish("Humidity", "Humidity is" + message.content + "%");
+        }
+    }
+
+    return 0;
+}